@@ -0,0 +1,250 @@
+#include <benchmark/benchmark.h>
+#include "../src/lexer.h"
+#include "../src/parser.h"
+#include "../src/runtime.h"
+#include <fstream>
+#include <functional>
+
+// A source of n copies of a small proc, so the lexer and parser see a mix of
+// keywords, literals, strings and comments.
+static std::string syntheticSource(int n)
+{
+    std::string code;
+    for (int i = 0; i < n; i++)
+    {
+        std::string id = std::to_string(i);
+        code += "// proc number " + id + "\n";
+        code += "const C" + id + " " + id + " 8 * end\n";
+        code += "proc p" + id + " int int -- int in\n";
+        code += "    let a b in\n";
+        code += "        a b + C" + id + " < if a else b 'x' + end\n";
+        code += "        \"str " + id + "\\n\" drop drop\n";
+        code += "    end\n";
+        code += "end\n";
+    }
+    return code;
+}
+
+static void BM_Lex(benchmark::State& state)
+{
+    std::string code = syntheticSource(state.range(0));
+    for (auto _ : state)
+    {
+        Lexer l(code);
+        benchmark::DoNotOptimize(l.lex());
+    }
+    state.SetBytesProcessed(state.iterations() * code.size());
+}
+BENCHMARK(BM_Lex)->Arg(100)->Arg(1000);
+
+static void BM_Parse(benchmark::State& state)
+{
+    std::string code = syntheticSource(state.range(0));
+    Lexer l(code);
+    auto tokens = l.lex();
+    for (auto _ : state)
+    {
+        Parser p(tokens);
+        auto asts = p.parse();
+        benchmark::DoNotOptimize(asts.data());
+        state.PauseTiming();
+        p.cleanup(asts);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * tokens.size());
+}
+BENCHMARK(BM_Parse)->Arg(100)->Arg(1000);
+
+static void BM_IncludeStd(benchmark::State& state)
+{
+    std::string path = "porth/std/std.porth";
+    if (!std::ifstream(path))
+    {
+        state.SkipWithError("porth/std/std.porth not found (is the porth submodule checked out?)");
+        return;
+    }
+    for (auto _ : state)
+    {
+        Env e;
+        include(path, e);
+        benchmark::DoNotOptimize(e.variables.size());
+    }
+}
+BENCHMARK(BM_IncludeStd);
+
+// Loads `code` once and times interpExpr on main's body. Kernels leave one
+// value on the stack and do not print. `cleanup`, if given, runs on the stack
+// after each iteration to release what the kernel allocated.
+static void runKernel(benchmark::State& state, const std::string& code,
+    std::function<void(Stack&)> cleanup = nullptr)
+{
+    Lexer l(code);
+    Parser p(l.lex());
+    auto asts = p.parse();
+    Env e;
+    load(asts, e);
+    ProcCmd *main = e.getProc("main");
+    for (auto _ : state)
+    {
+        Stack s;
+        benchmark::DoNotOptimize(interpExpr(main->body, s, e, main));
+        if (cleanup)
+            cleanup(s);
+    }
+    p.cleanup(asts);
+}
+
+static void BM_Arith(benchmark::State& state)
+{
+    runKernel(state,
+        "proc main in\n"
+        "    0 0 while dup 1000 < do\n"
+        "        swap over 3 * 7 + 5 divmod swap drop + swap 1 +\n"
+        "    end drop\n"
+        "end\n");
+}
+BENCHMARK(BM_Arith);
+
+static void BM_Call(benchmark::State& state)
+{
+    runKernel(state,
+        "proc inc int -- int in 1 + end\n"
+        "proc main in\n"
+        "    0 while dup 1000 < do inc end\n"
+        "end\n");
+}
+BENCHMARK(BM_Call);
+
+static void BM_Let(benchmark::State& state)
+{
+    runKernel(state,
+        "proc main in\n"
+        "    0 0 while dup 1000 < do\n"
+        "        let acc i in acc i + i 1 + end\n"
+        "    end drop\n"
+        "end\n");
+}
+BENCHMARK(BM_Let);
+
+static void BM_Peek(benchmark::State& state)
+{
+    runKernel(state,
+        "proc main in\n"
+        "    0 0 while dup 1000 < do\n"
+        "        peek acc i in acc i + end rot drop swap 1 +\n"
+        "    end drop\n"
+        "end\n");
+}
+BENCHMARK(BM_Peek);
+
+static void BM_Match(benchmark::State& state)
+{
+    runKernel(state,
+        "type T\n"
+        "| a[n :: int]\n"
+        "| b[n :: int, m :: int]\n"
+        "end\n"
+        "proc main in\n"
+        "    new T::a[1] new T::b[2, 3]\n"
+        "    0 0 while dup 1000 < do\n"
+        "        let x y acc i in\n"
+        "            x y acc i dup 1 and 0 = if x else y end\n"
+        "            match T\n"
+        "            | a[n]: n\n"
+        "            | b[n, m]: n m +\n"
+        "            end\n"
+        "            let v in swap v + swap 1 + end\n"
+        "        end\n"
+        "    end drop let x y acc in x y acc end\n"
+        "end\n",
+        [](Stack& s)
+        {
+            s.pop();
+            delete (VariantData *)s.pop().getValue();
+            delete (VariantData *)s.pop().getValue();
+        });
+}
+BENCHMARK(BM_Match);
+
+// The byte builtins against the Porth loops they replace, on a string literal
+// of 4095 'a's followed by one 'b'.
+static std::string haystack()
+{
+    return "\"" + std::string(4095, 'a') + "b\"";
+}
+
+static void BM_Memchr(benchmark::State& state)
+{
+    runKernel(state, "proc main in " + haystack() + " 'b' memchr end\n");
+}
+BENCHMARK(BM_Memchr);
+
+static void BM_MemchrPorth(benchmark::State& state)
+{
+    runKernel(state,
+        "proc main in\n"
+        "    " + haystack() + " let n s in\n"
+        "        0 while dup n < if dup s + @8 'b' != else 0 cast(bool) end do 1 + end\n"
+        "    end\n"
+        "end\n");
+}
+BENCHMARK(BM_MemchrPorth);
+
+static void BM_Memcmp(benchmark::State& state)
+{
+    runKernel(state, "proc main in 4096 " + haystack() + " swap drop " + haystack() + " swap drop memcmp end\n");
+}
+BENCHMARK(BM_Memcmp);
+
+static void BM_MemcmpPorth(benchmark::State& state)
+{
+    runKernel(state,
+        "proc main in\n"
+        "    " + haystack() + " " + haystack() + " let n a m b in\n"
+        "        0 while dup n < if dup a + @8 over b + @8 = else 0 cast(bool) end do 1 + end\n"
+        "    end\n"
+        "end\n");
+}
+BENCHMARK(BM_MemcmpPorth);
+
+static void BM_FindByteSet(benchmark::State& state)
+{
+    runKernel(state, "proc main in " + haystack() + " \",;b\" find-byte-set end\n");
+}
+BENCHMARK(BM_FindByteSet);
+
+static void BM_FindByteSetPorth(benchmark::State& state)
+{
+    runKernel(state,
+        "proc main in\n"
+        "    " + haystack() + " let n s in\n"
+        "        0 while dup n < if\n"
+        "            dup s + @8 let c in\n"
+        "                c ',' = if 0 cast(bool) else c ';' = if 0 cast(bool) else c 'b' != end end\n"
+        "            end\n"
+        "        else 0 cast(bool) end do 1 + end\n"
+        "    end\n"
+        "end\n");
+}
+BENCHMARK(BM_FindByteSetPorth);
+
+static void BM_CountByte(benchmark::State& state)
+{
+    runKernel(state, "proc main in " + haystack() + " 'a' count-byte end\n");
+}
+BENCHMARK(BM_CountByte);
+
+static void BM_CountBytePorth(benchmark::State& state)
+{
+    runKernel(state,
+        "proc main in\n"
+        "    " + haystack() + " let n s in\n"
+        "        0 0 while dup n < do\n"
+        "            dup s + @8 'a' = if swap 1 + swap end 1 +\n"
+        "        end drop\n"
+        "    end\n"
+        "end\n");
+}
+BENCHMARK(BM_CountBytePorth);
+
+BENCHMARK_MAIN();
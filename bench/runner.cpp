@@ -0,0 +1,290 @@
+// Times `cpporth run` on each program of the benchmark corpus and compares the
+// results against a saved baseline. See the Benchmarks section of README.md.
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class Result
+{
+public:
+    std::string name;
+    double wallMs = 0;      // median over the iterations
+    long peakRssKb = 0;     // largest over the iterations
+    long instructions = -1; // median, -1 if perf_event_open is unavailable
+};
+
+static std::string cpporth = "./cpporth";
+static int iterations = 5;
+static double threshold = 10;
+static bool reportOnly = false;
+
+static void usage()
+{
+    std::cout << "usage:\nbenchrunner [options] <file.porth>...\n";
+    std::cout << "options:\n";
+    std::cout << "  --cpporth=PATH     interpreter to time (default ./cpporth)\n";
+    std::cout << "  --iterations=N     runs per program (default 5)\n";
+    std::cout << "  --baseline=FILE    compare against FILE and fail on regressions\n";
+    std::cout << "  --threshold=PCT    allowed slowdown over the baseline in percent (default 10)\n";
+    std::cout << "  --report-only      print the comparison but do not fail on regressions\n";
+    std::cout << "  --out=FILE         write the results as JSON to FILE\n";
+    exit(1);
+}
+
+static std::string programName(const std::string& path)
+{
+    auto slash = path.find_last_of('/');
+    std::string base = slash == std::string::npos ? path : path.substr(slash + 1);
+    auto dot = base.rfind(".porth");
+    return dot == std::string::npos ? base : base.substr(0, dot);
+}
+
+// Counts user-space instructions retired by pid from its next exec on.
+static int openCounter(pid_t pid)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+// Runs the program once. The child blocks on a pipe until the counter is
+// attached, so only cpporth itself is counted.
+static bool runOnce(const std::string& path, double& wallMs, long& rssKb, long& instructions)
+{
+    int go[2];
+    if (pipe(go) != 0)
+        return false;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(go[1]);
+        char c;
+        if (read(go[0], &c, 1) != 1)
+            _exit(127);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execl(cpporth.c_str(), cpporth.c_str(), "run", path.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+    close(go[0]);
+
+    int fd = openCounter(pid);
+    auto start = std::chrono::steady_clock::now();
+    if (write(go[1], "x", 1) != 1)
+        return false;
+    close(go[1]);
+
+    int status;
+    rusage ru;
+    wait4(pid, &status, 0, &ru);
+    wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    rssKb = ru.ru_maxrss;
+
+    instructions = -1;
+    if (fd >= 0)
+    {
+        long long count;
+        if (read(fd, &count, sizeof(count)) == sizeof(count))
+            instructions = count;
+        close(fd);
+    }
+
+    if (WIFSIGNALED(status))
+    {
+        std::cerr << "Error: " << path << " was killed by signal " << WTERMSIG(status) << "\n";
+        return false;
+    }
+    if (WEXITSTATUS(status) != 0)
+    {
+        std::cerr << "Error: " << path << " exited with status " << WEXITSTATUS(status) << "\n";
+        return false;
+    }
+    return true;
+}
+
+template <typename T>
+static T median(std::vector<T> v)
+{
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+static bool measure(const std::string& path, Result& res)
+{
+    std::vector<double> walls;
+    std::vector<long> counts;
+    res.name = programName(path);
+    for (int i = 0; i < iterations; i++)
+    {
+        double wall;
+        long rss, count;
+        if (!runOnce(path, wall, rss, count))
+            return false;
+        walls.push_back(wall);
+        counts.push_back(count);
+        res.peakRssKb = std::max(res.peakRssKb, rss);
+    }
+    res.wallMs = median(walls);
+    res.instructions = median(counts);
+    return true;
+}
+
+static void writeJson(std::ostream& out, const std::vector<Result>& results)
+{
+    out << "{\n  \"iterations\": " << iterations << ",\n  \"programs\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        auto& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"wall_ms\": " << r.wallMs
+            << ", \"peak_rss_kb\": " << r.peakRssKb << ", \"instructions\": " << r.instructions << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+static double field(const std::string& line, const std::string& key)
+{
+    auto pos = line.find("\"" + key + "\": ");
+    if (pos == std::string::npos)
+        return -1;
+    return strtod(line.c_str() + pos + key.size() + 4, nullptr);
+}
+
+// Reads the one-program-per-line JSON that writeJson produces.
+static std::vector<Result> readJson(const std::string& path)
+{
+    std::vector<Result> results;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        auto pos = line.find("\"name\": \"");
+        if (pos == std::string::npos)
+            continue;
+        Result r;
+        pos += 9;
+        r.name = line.substr(pos, line.find('"', pos) - pos);
+        r.wallMs = field(line, "wall_ms");
+        r.peakRssKb = field(line, "peak_rss_kb");
+        r.instructions = field(line, "instructions");
+        results.push_back(r);
+    }
+    return results;
+}
+
+// Prints one metric against the baseline and returns true if it regressed.
+static bool compareMetric(const std::string& name, const char *metric, double cur, double base)
+{
+    if (cur < 0 || base <= 0)
+        return false;
+    double delta = (cur - base) / base * 100;
+    bool regressed = delta > threshold;
+    printf("  %-14s %-14s %14.2f %14.2f %+8.2f%%%s\n", name.c_str(), metric, base, cur, delta,
+           regressed ? "  REGRESSION" : "");
+    return regressed;
+}
+
+int main(int argc, char **argv)
+{
+    std::string baselinePath, outPath;
+    std::vector<std::string> programs;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--cpporth=", 0) == 0)
+            cpporth = arg.substr(10);
+        else if (arg.rfind("--iterations=", 0) == 0)
+            iterations = std::max(1, atoi(arg.c_str() + 13));
+        else if (arg.rfind("--baseline=", 0) == 0)
+            baselinePath = arg.substr(11);
+        else if (arg.rfind("--threshold=", 0) == 0)
+            threshold = atof(arg.c_str() + 12);
+        else if (arg == "--report-only")
+            reportOnly = true;
+        else if (arg.rfind("--out=", 0) == 0)
+            outPath = arg.substr(6);
+        else if (arg.rfind("--", 0) == 0)
+        {
+            std::cout << "Unknown option: " << arg << std::endl;
+            usage();
+        }
+        else
+            programs.push_back(arg);
+    }
+    if (programs.empty())
+        usage();
+
+    std::vector<Result> results;
+    for (auto& path : programs)
+    {
+        Result r;
+        if (!measure(path, r))
+            return 1;
+        printf("%-14s %10.2f ms %10ld KB %14ld instructions\n", r.name.c_str(), r.wallMs, r.peakRssKb, r.instructions);
+        results.push_back(r);
+    }
+    if (results[0].instructions < 0)
+        std::cerr << "perf_event_open is unavailable, instruction counts are not recorded\n";
+
+    if (!outPath.empty())
+    {
+        std::ofstream out(outPath);
+        writeJson(out, results);
+    }
+
+    if (baselinePath.empty())
+        return 0;
+    std::ifstream probe(baselinePath);
+    if (!probe)
+    {
+        std::cerr << "No baseline at " << baselinePath << ", nothing to compare (make bench-baseline saves one)\n";
+        return 0;
+    }
+
+    auto baseline = readJson(baselinePath);
+    int regressions = 0;
+    double baseTotal = 0, curTotal = 0;
+    printf("\ncompared to %s (threshold %.1f%%):\n", baselinePath.c_str(), threshold);
+    printf("  %-14s %-14s %14s %14s %9s\n", "program", "metric", "baseline", "current", "change");
+    for (auto& r : results)
+    {
+        auto it = std::find_if(baseline.begin(), baseline.end(), [&](const Result& b) { return b.name == r.name; });
+        if (it == baseline.end())
+        {
+            printf("  %-14s not in the baseline\n", r.name.c_str());
+            continue;
+        }
+        baseTotal += it->wallMs;
+        curTotal += r.wallMs;
+        regressions += compareMetric(r.name, "wall_ms", r.wallMs, it->wallMs);
+        regressions += compareMetric(r.name, "peak_rss_kb", r.peakRssKb, it->peakRssKb);
+        regressions += compareMetric(r.name, "instructions", r.instructions, it->instructions);
+    }
+    if (curTotal > 0)
+        printf("total wall time %.2f ms -> %.2f ms, speedup %.3fx\n", baseTotal, curTotal, baseTotal / curTotal);
+    if (regressions > 0 && !reportOnly)
+    {
+        printf("%d regression(s) above %.1f%%\n", regressions, threshold);
+        return 1;
+    }
+    return 0;
+}
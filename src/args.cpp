@@ -1,28 +1,137 @@
 #include "args.h"
 #include <iostream>
+#include <algorithm>
+#include <cstdlib>
+
+Options options;
 
 void usage()
 {
     std::cout << "usage:\n";
-    std::cout << "cpporth run <file>";
-    std::cout << "cpporth run <file> -- <args>\n";
+    std::cout << "cpporth run [options] <file>\n";
+    std::cout << "cpporth run [options] <file> -- <args>\n";
+    std::cout << "cpporth compile --target=asm [options] <file>\n";
+    std::cout << "options:\n";
+    std::cout << "  --io-uring    batch read/write/openat/close syscalls through io_uring\n";
+    std::cout << "  --lazy-procs  parse proc bodies on first call instead of at load time\n";
+    std::cout << "  --no-dce      keep procs and types that are unreachable from main\n";
+    std::cout << "  --no-fold     do not substitute consts or fold constant expressions\n";
+    std::cout << "  --no-shuffle  keep swap/rot/over/dup/drop as written\n";
+    std::cout << "  --no-super    do not fuse common sequences into superinstructions\n";
+    std::cout << "  --no-native   run included std procs such as memcpy as Porth instead of C++\n";
+    std::cout << "  --ngrams      count executed 2- and 3-grams and print the most frequent to stderr\n";
+    std::cout << "  --op-stats    count executed words by kind, op and line and print them to stderr\n";
+    std::cout << "  --ir          run procs that lower to the optimized SSA IR on the register VM\n";
+    std::cout << "  --dump-ir     print each proc's IR after every IR pass to stderr\n";
+    std::cout << "  --tiered      move procs and loops in main to the IR tier once they get hot\n";
+    std::cout << "  --tier-threshold=N  calls plus loop iterations before --tiered promotes (default 1000)\n";
+    std::cout << "  --verbose     log tier-up events to stderr\n";
+    std::cout << "  --profile     time every proc call and print a per-proc table to stderr at exit\n";
+    std::cout << "  --heap-profile  track runtime allocations by site and report peaks and leaks to stderr\n";
+    std::cout << "  --check-memory  stop with the Porth line when @ or ! leaves every known region\n";
+    std::cout << "  --sample-hz N sample the Porth call stack N times per second of CPU time (or --sample-hz=N)\n";
+    std::cout << "  --sample-out=FILE  write --sample-hz folded stacks to FILE instead of stderr\n";
+    std::cout << "  --trace FILE  write Chrome trace events for load phases and slow proc calls to FILE\n";
+    std::cout << "  --trace-min-us=N  shortest proc call --trace records, in microseconds (default 100)\n";
+    std::cout << "  --target=asm  (compile) emit x86-64 assembly and link a static executable\n";
 }
 
 Args::Args(int argc, char **argv)
 {
-    if (argc < 2)
+    if (argc < 3)
+    {
+        usage();
+        exit(1);
+    }
+
+    command = argv[1];
+    if (command != "run" && command != "compile")
+    {
+        usage();
+        exit(1);
+    }
+
+    int i = 2;
+    for (; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0 || arg == "--")
+            break;
+
+        if (arg == "--io-uring")
+            options.ioUring = true;
+        else if (arg == "--lazy-procs")
+            options.lazyProcs = true;
+        else if (arg == "--no-dce")
+            options.deadProcElim = false;
+        else if (arg == "--no-fold")
+            options.constFold = false;
+        else if (arg == "--no-shuffle")
+            options.shuffleElim = false;
+        else if (arg == "--no-super")
+            options.superinstructions = false;
+        else if (arg == "--no-native")
+            options.nativeStd = false;
+        else if (arg == "--ngrams")
+            options.ngrams = true;
+        else if (arg == "--op-stats")
+            options.opStats = true;
+        else if (arg == "--ir")
+            options.ir = true;
+        else if (arg == "--dump-ir")
+            options.dumpIR = true;
+        else if (arg == "--tiered")
+            options.tiered = true;
+        else if (arg.rfind("--tier-threshold=", 0) == 0)
+            options.tierThreshold = std::max(1L, std::atol(arg.c_str() + 17));
+        else if (arg == "--verbose")
+            options.verbose = true;
+        else if (arg == "--profile")
+            options.profile = true;
+        else if (arg == "--heap-profile")
+            options.heapProfile = true;
+        else if (arg == "--check-memory")
+            options.checkMemory = true;
+        else if (arg.rfind("--sample-hz=", 0) == 0)
+            options.sampleHz = std::max(1L, std::atol(arg.c_str() + 12));
+        else if (arg == "--sample-hz" && i + 1 < argc)
+            options.sampleHz = std::max(1L, std::atol(argv[++i]));
+        else if (arg.rfind("--sample-out=", 0) == 0)
+            options.sampleOut = arg.substr(13);
+        else if (arg == "--trace" && i + 1 < argc)
+            options.trace = argv[++i];
+        else if (arg.rfind("--trace-min-us=", 0) == 0)
+            options.traceMinUs = std::max(0L, std::atol(arg.c_str() + 15));
+        else if (command == "compile" && arg.rfind("--target=", 0) == 0)
+        {
+            target = arg.substr(9);
+            if (target != "asm")
+            {
+                std::cout << "Unknown target: " << target << std::endl;
+                usage();
+                exit(1);
+            }
+        }
+        else
+        {
+            std::cout << "Unknown option: " << arg << std::endl;
+            usage();
+            exit(1);
+        }
+    }
+
+    if (i >= argc)
     {
         usage();
         exit(1);
     }
 
-    expect("run", argv[1]);
-    filepath = argv[2];
+    filepath = argv[i++];
     porthArgs.push_back(filepath);
-    if (argc > 3)
+    if (i < argc)
     {
-        expect("--", argv[3]);
-        for (int i = 4; i < argc; i++)
+        expect("--", argv[i]);
+        for (i++; i < argc; i++)
             porthArgs.push_back(argv[i]);
     }
 
@@ -35,4 +144,4 @@ void Args::expect(std::string exp, std::string act)
         usage();
         exit(1);
     }
-}
\ No newline at end of file
+}
@@ -2,13 +2,45 @@
 #define CPPORTH_ARGS_H
 
 // usage:
-// ./cpporth run <file> -- <porth args>
+// ./cpporth run [options] <file> -- <porth args>
+// ./cpporth compile --target=asm [options] <file>
 #include <string>
 #include <vector>
 
+// Switches set from the command line, read by the runtime.
+class Options
+{
+public:
+    bool ioUring = false;
+    bool lazyProcs = false;
+    bool deadProcElim = true;
+    bool constFold = true;
+    bool shuffleElim = true;
+    bool superinstructions = true;
+    bool nativeStd = true;
+    bool ngrams = false;
+    bool opStats = false;
+    bool ir = false;
+    bool dumpIR = false;
+    bool tiered = false;
+    long tierThreshold = 1000;
+    bool verbose = false;
+    bool profile = false;
+    bool heapProfile = false;
+    bool checkMemory = false;
+    long sampleHz = 0;
+    std::string sampleOut;      // empty: stderr
+    std::string trace;          // --trace output path, empty when off
+    long traceMinUs = 100;
+};
+
+extern Options options;
+
 class Args
 {
 public:
+    std::string command;            // "run" or "compile"
+    std::string target = "asm";     // compile --target
     std::string filepath;
     std::vector<std::string> porthArgs;
     Args(int, char**);
@@ -17,4 +49,4 @@ public:
 
 void usage();
 
-#endif // CPPORTH_ARGS_H
\ No newline at end of file
+#endif // CPPORTH_ARGS_H
@@ -1,4 +1,6 @@
 #include "ast.h"
+#include "parser.h"
+#include "optimizer.h"
 
 Type::Type(TypeKind kind) : kind(kind) {;}
 std::string Type::toString()
@@ -24,11 +26,11 @@ std::string VariantType::toString()
     return "(VariantType " + name + ")";
 }
 
-MemoryExpr::MemoryExpr(std::string name, std::vector<Expr*> body) : ident(name), body(body) {;}
+MemoryExpr::MemoryExpr(std::string name, std::vector<Expr*> body) : sym(intern(name)), body(body) {;}
 
 MemoryExpr::MemoryExpr(MemoryExpr *other)
 {
-    ident = std::string(other->ident);
+    sym = other->sym;
     body = std::vector<Expr*>(other->body);
 }
 
@@ -40,13 +42,13 @@ MemoryExpr::~MemoryExpr()
 
 std::string MemoryExpr::getIdent()
 {
-    return ident;
+    return symbolName(sym);
 }
 
 std::string MemoryExpr::toString()
 {
     if (body.size() == 0)
-        return "(MemoryExpr " + ident + ")";
+        return "(MemoryExpr " + symbolName(sym) + ")";
 
     std::string acc = "(";
     int idx = 0;
@@ -57,7 +59,7 @@ std::string MemoryExpr::toString()
     }
 
 
-    return "(MemoryExpr " + ident + " " + acc + ")";
+    return "(MemoryExpr " + symbolName(sym) + " " + acc + ")";
 }   
 
 ASTKind MemoryExpr::getASTKind()
@@ -76,7 +78,15 @@ ASTKind PrintExpr::getASTKind()
     return ASTKind::PRINTEXPR;
 }
 
-LetExpr::LetExpr(std::vector<std::string> idents, std::vector<Expr*> body) : idents(idents), body(body) {;}
+static std::vector<Symbol> internAll(const std::vector<std::string>& names)
+{
+    std::vector<Symbol> syms;
+    for (auto& name : names)
+        syms.push_back(intern(name));
+    return syms;
+}
+
+LetExpr::LetExpr(std::vector<std::string> idents, std::vector<Expr*> body) : idents(internAll(idents)), body(body) {;}
 LetExpr::~LetExpr()
 {
     for (auto e : body)
@@ -88,7 +98,7 @@ std::string LetExpr::toString()
     int idx = 0;
     for (auto ident : idents)
     {
-        acc += ident + (idx < idents.size()-1 ? " " : "");
+        acc += symbolName(ident) + (idx < idents.size()-1 ? " " : "");
         idx++;
     }
     acc += ")";
@@ -109,7 +119,7 @@ ASTKind LetExpr::getASTKind()
     return ASTKind::LETSTMT;
 }
 
-PeekExpr::PeekExpr(std::vector<std::string> idents, std::vector<Expr*> body) : idents(idents), body(body) {;}
+PeekExpr::PeekExpr(std::vector<std::string> idents, std::vector<Expr*> body) : idents(internAll(idents)), body(body) {;}
 PeekExpr::~PeekExpr()
 {
     for (auto e : body)
@@ -121,7 +131,7 @@ std::string PeekExpr::toString()
     int idx = 0;
     for (auto ident : idents)
     {
-        acc += ident + (idx < idents.size()-1 ? " " : "");
+        acc += symbolName(ident) + (idx < idents.size()-1 ? " " : "");
         idx++;
     }
     acc += ")";
@@ -142,7 +152,37 @@ ASTKind PeekExpr::getASTKind()
     return ASTKind::PEEKSTMT;
 }
 
-OpExpr::OpExpr(std::string op) : op(op) {;}
+static const std::unordered_map<std::string, OpKind>& opKinds()
+{
+    static const std::unordered_map<std::string, OpKind> kinds = {
+        {"+", OpKind::ADD}, {"-", OpKind::SUB}, {"*", OpKind::MUL},
+        {"divmod", OpKind::DIVMOD}, {"idivmod", OpKind::IDIVMOD},
+        {"<", OpKind::LT}, {">", OpKind::GT}, {"<=", OpKind::LE}, {">=", OpKind::GE},
+        {"=", OpKind::EQ}, {"!=", OpKind::NE},
+        {"shr", OpKind::SHR}, {"shl", OpKind::SHL}, {"or", OpKind::OR}, {"and", OpKind::AND}, {"not", OpKind::NOT},
+        {"!8", OpKind::STORE8}, {"@8", OpKind::LOAD8}, {"!16", OpKind::STORE16}, {"@16", OpKind::LOAD16},
+        {"!32", OpKind::STORE32}, {"@32", OpKind::LOAD32}, {"!64", OpKind::STORE64}, {"@64", OpKind::LOAD64},
+        {"cast(bool)", OpKind::CASTBOOL}, {"cast(int)", OpKind::CASTINT}, {"cast(ptr)", OpKind::CASTPTR},
+    };
+    return kinds;
+}
+
+static OpKind opKind(const std::string& op)
+{
+    auto& kinds = opKinds();
+    auto it = kinds.find(op);
+    return it == kinds.end() ? OpKind::UNKNOWN : it->second;
+}
+
+std::string opName(OpKind kind)
+{
+    for (auto& [name, k] : opKinds())
+        if (k == kind)
+            return name;
+    return "?";
+}
+
+OpExpr::OpExpr(std::string op) : op(op), kind(opKind(op)) {;}
 OpExpr::~OpExpr() {}
 std::string OpExpr::toString()
 {
@@ -191,6 +231,17 @@ ASTKind FalseExpr::getASTKind()
     return ASTKind::FALSEEXPR;
 }
 
+ImmExpr::ImmExpr(long value, TypeKind type) : value(value), type(type) {;}
+std::string ImmExpr::toString()
+{
+    return "(ImmExpr " + std::to_string(value) + " " + Type(type).toString() + ")";
+}
+
+ASTKind ImmExpr::getASTKind()
+{
+    return ASTKind::IMMEXPR;
+}
+
 CharExpr::CharExpr(char c) : ch(c) {;}
 std::string CharExpr::toString()
 {
@@ -229,10 +280,11 @@ ASTKind StringLitExpr::getASTKind()
     return ASTKind::STRINGLITEXPR;
 }
 
-VarExpr::VarExpr(std::string name) : name(name) {;}
+VarExpr::VarExpr(std::string name) : sym(intern(name)) {;}
+VarExpr::VarExpr(Symbol sym) : sym(sym) {;}
 std::string VarExpr::toString()
 {
-    return "(VarExpr " + name + ")";
+    return "(VarExpr " + symbolName(sym) + ")";
 }
 
 
@@ -406,7 +458,7 @@ AddrOfExpr::~AddrOfExpr()
 }
 std::string AddrOfExpr::toString()
 {
-    return "(AddrOfExpr " + proc->name + ")";
+    return "(AddrOfExpr " + symbolName(proc->sym) + ")";
 }
 ASTKind AddrOfExpr::getASTKind()
 {
@@ -420,7 +472,7 @@ CallLikeExpr::~CallLikeExpr()
 }
 std::string CallLikeExpr::toString() 
 {
-    return "(CallLikeExpr " + proc->name + ")";
+    return "(CallLikeExpr " + symbolName(proc->sym) + ")";
 }
 ASTKind CallLikeExpr::getASTKind()
 {
@@ -482,6 +534,59 @@ ASTKind RotExpr::getASTKind()
     return ASTKind::ROTEXPR;
 }
 
+PermuteExpr::PermuteExpr(int depth, std::vector<int> order) : depth(depth), order(order) {;}
+std::string PermuteExpr::toString()
+{
+    std::string acc = "(PermuteExpr " + std::to_string(depth) + " (";
+    for (int i = 0; i < order.size(); i++)
+        acc += std::to_string(order[i]) + (i < order.size()-1 ? " " : "");
+    return acc + "))";
+}
+ASTKind PermuteExpr::getASTKind()
+{
+    return ASTKind::PERMUTEEXPR;
+}
+
+SuperExpr::SuperExpr(SuperKind kind) : kind(kind) {;}
+std::string SuperExpr::toString()
+{
+    switch (kind)
+    {
+        case SuperKind::ADDIMM: return "(SuperExpr " + std::to_string(imm) + " +)";
+        case SuperKind::DUPLOAD8: return "(SuperExpr dup @8)";
+        case SuperKind::DUPLOAD64: return "(SuperExpr dup @64)";
+        case SuperKind::OVEROVERCMP: return "(SuperExpr over over " + opName(cmp) + ")";
+        case SuperKind::SWAPSTORE8: return "(SuperExpr swap !8)";
+        case SuperKind::SWAPSTORE64: return "(SuperExpr swap !64)";
+    }
+    return "(SuperExpr)";
+}
+ASTKind SuperExpr::getASTKind()
+{
+    return ASTKind::SUPEREXPR;
+}
+
+ScanExpr::ScanExpr(ScanKind kind) : kind(kind) {;}
+std::string ScanExpr::name()
+{
+    switch (kind)
+    {
+        case ScanKind::MEMCHR: return "memchr";
+        case ScanKind::MEMCMP: return "memcmp";
+        case ScanKind::FINDBYTESET: return "find-byte-set";
+        case ScanKind::COUNTBYTE: return "count-byte";
+    }
+    return "scan";
+}
+std::string ScanExpr::toString()
+{
+    return "(ScanExpr " + name() + ")";
+}
+ASTKind ScanExpr::getASTKind()
+{
+    return ASTKind::SCANEXPR;
+}
+
 HereExpr::HereExpr() {;}
 HereExpr::~HereExpr() {;}
 std::string HereExpr::toString()
@@ -542,7 +647,7 @@ ASTKind FreeExpr::getASTKind()
 }
 
 VariantBinding::VariantBinding(std::vector<std::string> idents, std::vector<Expr*> body) :
-    idents(idents), body(body) {;}
+    idents(internAll(idents)), body(body) {;}
 VariantBinding::~VariantBinding()
 {
     for (auto e : body)
@@ -558,7 +663,11 @@ ASTKind VariantBinding::getASTKind()
 }
 
 MatchExpr::MatchExpr(std::unordered_map<std::string, VariantBinding*> map, std::string supertype) :
-    branches(map), supertype(supertype) {;}
+    supertype(intern(supertype))
+{
+    for (auto& [name, binding] : map)
+        branches.insert(std::make_pair(intern(name), binding));
+}
 MatchExpr::~MatchExpr()
 {
     for (auto [name, binding] : branches)
@@ -566,13 +675,13 @@ MatchExpr::~MatchExpr()
 }
 std::string MatchExpr::toString()
 {
-    std::string acc = "(MatchExpr " + supertype + " ";
+    std::string acc = "(MatchExpr " + symbolName(supertype) + " ";
 
     int i = 0;
     for (auto [name, binding] : branches)
     {
         int ec = 0;
-        acc += "(" + name + " (";
+        acc += "(" + symbolName(name) + " (";
         for (auto e : binding->body)
         {
             acc += e->toString() + (ec < binding->body.size()-1 ? " " : "");
@@ -592,7 +701,7 @@ ASTKind MatchExpr::getASTKind()
 }
 
 VariantInstanceExpr::VariantInstanceExpr(std::string name, std::string parentName, std::vector<std::vector<Expr *> > args) :
-    variant(name), parent(parentName), args(args) {;}
+    parentSym(intern(parentName)), variantSym(intern(name)), args(args) {;}
 VariantInstanceExpr::~VariantInstanceExpr()
 {
     for (auto a : args)
@@ -601,7 +710,7 @@ VariantInstanceExpr::~VariantInstanceExpr()
 }
 std::string VariantInstanceExpr::toString()
 {
-    std::string acc = "(Variant " + parent + "::" + variant + " ";
+    std::string acc = "(Variant " + symbolName(parentSym) + "::" + symbolName(variantSym) + " ";
 
     int expc = 0;
     int argc = 0;
@@ -709,9 +818,37 @@ std::string FnSignature::toString()
     return "(" + ins + "-- " + outs + ")";
 }
 
-ProcCmd::ProcCmd(std::string name, FnSignature sig, std::vector<Expr*> body) : name(name), sig(sig), body(body) {;}
+std::vector<ProcCmd*> ProcCmd::table(1, nullptr);
+
+ProcCmd::ProcCmd(std::string name, FnSignature sig, std::vector<Expr*> body) : name(name), sig(sig), body(body), parsed(true)
+{
+    id = table.size();
+    table.push_back(this);
+}
+ProcCmd::ProcCmd(std::string name, FnSignature sig, int start, int end) : name(name), sig(sig), bodyStart(start), bodyEnd(end), parsed(false)
+{
+    id = table.size();
+    table.push_back(this);
+}
+
+std::vector<Expr*>& ProcCmd::getBody()
+{
+    if (!parsed)
+    {
+        std::vector<Token> tokens(source->begin() + bodyStart, source->begin() + bodyEnd);
+        tokens.push_back(Token(-1, -1, tokens.back().line, TokenType::END_OF_FILE, "EOF"));
+        Parser p(tokens);
+        body = p.parseExpr();
+        check(p.pop(), TokenType::END);
+        source.reset();
+        parsed = true;
+        prepareLazyBody(this);
+    }
+    return body;
+}
 ProcCmd::~ProcCmd()
 {
+    table[id] = nullptr;
     for (AST *ast : body)
         delete ast;
 }
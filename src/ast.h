@@ -2,7 +2,14 @@
 #define CPPORTH_AST_H
 
 #include <string>
+#include <memory>
 #include <unordered_map>
+#include "lexer.h"
+#include "symbols.h"
+
+class ProcCmd;
+class IRFunc;
+class Stack;
 
 enum class TypeKind
 {
@@ -52,13 +59,52 @@ enum class ASTKind
     MATCHSTMT,
     VARIANTINSTANCEEXPR,
     VARIANTBINDING,
-    ARRAYLITEXPR
-};
+    ARRAYLITEXPR,
+    IMMEXPR,
+    PERMUTEEXPR,
+    SCANEXPR,
+    SUPEREXPR
+};
+
+enum class OpKind
+{
+    ADD,
+    SUB,
+    MUL,
+    DIVMOD,
+    IDIVMOD,
+    LT,
+    GT,
+    LE,
+    GE,
+    EQ,
+    NE,
+    SHR,
+    SHL,
+    OR,
+    AND,
+    NOT,
+    STORE8,
+    LOAD8,
+    STORE16,
+    LOAD16,
+    STORE32,
+    LOAD32,
+    STORE64,
+    LOAD64,
+    CASTBOOL,
+    CASTINT,
+    CASTPTR,
+    UNKNOWN
+};
+
+// Source spelling of an op, e.g. "+" or "@64".
+std::string opName(OpKind);
 
 class AST 
 { 
 public:
-    int line;
+    int line = 0;
     virtual ~AST() = 0;
     virtual std::string toString() = 0;
     virtual ASTKind getASTKind() = 0;
@@ -183,11 +229,24 @@ public:
     ASTKind getASTKind() override;
 };
 
+// A value known before execution, e.g. a const substituted into a proc body
+// or the result of folding constant arithmetic.
+class ImmExpr : public Expr
+{
+public:
+    long value;
+    TypeKind type;
+    ImmExpr(long, TypeKind);
+    std::string toString() override;
+    ASTKind getASTKind() override;
+};
+
 class VarExpr : public Expr
 {
 public:
-    std::string name;
+    Symbol sym;
     VarExpr(std::string);
+    VarExpr(Symbol);
     std::string getName();
     std::string toString() override;
     ASTKind getASTKind() override;
@@ -214,8 +273,8 @@ public:
 class VariantInstanceExpr : public Expr
 {
 public:
-    std::string parent;
-    std::string variant;
+    Symbol parentSym;
+    Symbol variantSym;
     std::vector<std::vector<Expr *> > args;
     VariantInstanceExpr(std::string, std::string, std::vector<std::vector<Expr *> >);
     ~VariantInstanceExpr();
@@ -226,7 +285,7 @@ public:
 class VariantBinding : public Expr
 {
 public:
-    std::vector<std::string> idents;
+    std::vector<Symbol> idents;
     std::vector<Expr *> body;
     VariantBinding(std::vector<std::string>, std::vector<Expr*>);
     ~VariantBinding();
@@ -237,8 +296,8 @@ public:
 class MatchExpr : public Expr
 {
 public:
-    std::unordered_map<std::string, VariantBinding*> branches;
-    std::string supertype;
+    std::unordered_map<Symbol, VariantBinding*> branches;
+    Symbol supertype;
     MatchExpr(std::unordered_map<std::string, VariantBinding*>, std::string);
     ~MatchExpr();
     std::string toString() override;
@@ -261,6 +320,7 @@ public:
     std::vector<Expr*> then;
     std::vector<Expr*> elze;
     IfExpr *next;
+    OpKind cmp = OpKind::UNKNOWN;   // set when the condition's comparison is fused into the branch
     IfExpr(std::vector<Expr*>, std::vector<Expr*>, IfExpr *);
     ~IfExpr();
     std::string toString() override;
@@ -269,8 +329,8 @@ public:
 
 class MemoryExpr : public Expr
 {
-    std::string ident;
 public:
+    Symbol sym;
     std::vector<Expr*> body;
     MemoryExpr(std::string, std::vector<Expr*>);
     MemoryExpr(MemoryExpr *);
@@ -285,6 +345,11 @@ class WhileExpr : public Expr
 public:
     std::vector<Expr*> cond;
     std::vector<Expr*> body;
+    OpKind cmp = OpKind::UNKNOWN;   // set when cond's final comparison is fused into the loop test
+    long backEdges = 0;             // --tiered: condition runs since the last OSR
+    bool noOSR = false;             // --tiered: the loop failed to lower
+    std::shared_ptr<IRFunc> osr;    // --tiered: lowered loop without scoped bindings, reused on entry
+    int osrDepth = 0;               // the stack depth osr was lowered for
     WhileExpr(std::vector<Expr*>, std::vector<Expr*>);
     ~WhileExpr();
     std::string toString() override;
@@ -315,6 +380,7 @@ class OpExpr : public Expr
 {
 public:
     std::string op;
+    OpKind kind;
     OpExpr(std::string);
     ~OpExpr();
     std::string toString() override;
@@ -324,7 +390,7 @@ public:
 class LetExpr : public Expr
 {
 public:
-    std::vector<std::string> idents;
+    std::vector<Symbol> idents;
     std::vector<Expr*> body;
     LetExpr(std::vector<std::string>, std::vector<Expr*>);
     ~LetExpr();
@@ -335,7 +401,7 @@ public:
 class PeekExpr : public Expr
 {
 public:
-    std::vector<std::string> idents;
+    std::vector<Symbol> idents;
     std::vector<Expr*> body;
     PeekExpr(std::vector<std::string>, std::vector<Expr*>);
     ~PeekExpr();
@@ -365,6 +431,7 @@ class AddrOfExpr : public Expr
 {
 public:
     VarExpr *proc;
+    ProcCmd *target = nullptr;      // resolved on first execution
     AddrOfExpr(VarExpr *);
     ~AddrOfExpr();
     std::string toString() override;
@@ -375,6 +442,8 @@ class CallLikeExpr : public Expr
 {
 public:
     VarExpr *proc;
+    long cachedId = 0;              // inline cache: last addr called from here
+    ProcCmd *cached = nullptr;
     CallLikeExpr(VarExpr *);
     ~CallLikeExpr();
     std::string toString() override;
@@ -426,6 +495,60 @@ public:
     ASTKind getASTKind() override;
 };
 
+// A run of swap/rot/over/dup/drop collapsed into one step: pops `depth`
+// cells and pushes back order[i]-th of them (0 = deepest popped cell).
+class PermuteExpr : public Expr
+{
+public:
+    static const int MAX_DEPTH = 16;
+    int depth;
+    std::vector<int> order;
+    PermuteExpr(int, std::vector<int>);
+    std::string toString() override;
+    ASTKind getASTKind() override;
+};
+
+// Fused handlers for frequent expression sequences.
+enum class SuperKind
+{
+    ADDIMM,         // k +  and  k -
+    DUPLOAD8,       // dup @8
+    DUPLOAD64,      // dup @64
+    OVEROVERCMP,    // over over <cmp>
+    SWAPSTORE8,     // swap !8
+    SWAPSTORE64     // swap !64
+};
+
+class SuperExpr : public Expr
+{
+public:
+    SuperKind kind;
+    long imm = 0;
+    OpKind cmp = OpKind::UNKNOWN;
+    SuperExpr(SuperKind);
+    std::string toString() override;
+    ASTKind getASTKind() override;
+};
+
+// Porth++ byte builtins, implemented in bytescan.h.
+enum class ScanKind
+{
+    MEMCHR,         // n s byte -- index or -1
+    MEMCMP,         // n a b -- -1, 0 or 1
+    FINDBYTESET,    // n s setn set -- index or -1
+    COUNTBYTE       // n s byte -- count
+};
+
+class ScanExpr : public Expr
+{
+public:
+    ScanKind kind;
+    ScanExpr(ScanKind);
+    std::string name();
+    std::string toString() override;
+    ASTKind getASTKind() override;
+};
+
 class HereExpr : public Expr
 {
 public:
@@ -439,6 +562,7 @@ class SyscallExpr : public Expr
 {
     int n;
 public:
+    bool resultUsed = true;     // false when followed by drop, or ending a proc whose callers all drop
     SyscallExpr(int);
     ~SyscallExpr();
     int getNumArgs();
@@ -476,7 +600,28 @@ public:
     FnSignature sig;
     std::vector<Expr*> body;    
     std::string name;           
+    // --lazy-procs: body is source[bodyStart, bodyEnd), parsed on first getBody().
+    std::shared_ptr<std::vector<Token> > source;
+    int bodyStart;
+    int bodyEnd;
+    bool parsed;
+    // Index into table, assigned on construction. addr values are these ids.
+    long id;
+    static std::vector<ProcCmd*> table;     // table[0] is never a proc
+    std::string file;                       // the file it was loaded from
+    std::shared_ptr<IRFunc> ir;             // set by lowerProcs under --ir, or by tierUp
+    long calls = 0;                         // --tiered: calls and loop back-edges so far
+    long backEdges = 0;
+    bool tierFailed = false;                // --tiered: does not lower, stays interpreted
+    void (*native)(Stack&) = nullptr;       // set by bindNative: runs instead of body
+    std::string library;                    // extern: the library symbol is looked up in
+    void *symbol = nullptr;                 // extern: set by bindExtern, with a thunk
+    void (*thunk)(Stack&, void *) = nullptr; // that calls it with sig's arity
+    bool resultDropped = false;             // every call site drops its result
+    unsigned shadowedScans = 0;             // --lazy-procs: byte builtins to parse as calls (bit per ScanKind)
     ProcCmd(std::string, FnSignature, std::vector<Expr*>);
+    ProcCmd(std::string, FnSignature, int, int);
+    std::vector<Expr*>& getBody();
     ~ProcCmd() override;
     std::string toString() override;
     ASTKind getASTKind() override;
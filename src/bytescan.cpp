@@ -0,0 +1,257 @@
+#include "bytescan.h"
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// SCALAR
+
+static long memchrScalar(const unsigned char *s, long n, long byte)
+{
+    for (long i = 0; i < n; i++)
+        if (s[i] == byte)
+            return i;
+    return -1;
+}
+
+static long memcmpScalar(const unsigned char *a, const unsigned char *b, long n)
+{
+    for (long i = 0; i < n; i++)
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    return 0;
+}
+
+static long findByteSetScalar(const unsigned char *s, long n, const unsigned char *set, long setn)
+{
+    bool in[256] = {};
+    for (long i = 0; i < setn; i++)
+        in[set[i]] = true;
+    for (long i = 0; i < n; i++)
+        if (in[s[i]])
+            return i;
+    return -1;
+}
+
+static long countByteScalar(const unsigned char *s, long n, long byte)
+{
+    long count = 0;
+    for (long i = 0; i < n; i++)
+        count += s[i] == byte;
+    return count;
+}
+
+#if defined(__x86_64__)
+
+// The vector loops only load whole blocks inside [s, s + n) and leave the
+// tail to the scalar loops, so they never read past the buffer.
+
+// SSE4.2
+
+__attribute__((target("sse4.2")))
+static long memchrSse42(const unsigned char *s, long n, long byte)
+{
+    __m128i v = _mm_set1_epi8((char)byte);
+    long i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i)), v));
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    long r = memchrScalar(s + i, n - i, byte);
+    return r < 0 ? -1 : i + r;
+}
+
+__attribute__((target("sse4.2")))
+static long memcmpSse42(const unsigned char *a, const unsigned char *b, long n)
+{
+    long i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        int m = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xFFFF;
+        if (m)
+        {
+            long k = i + __builtin_ctz(m);
+            return a[k] < b[k] ? -1 : 1;
+        }
+    }
+    return memcmpScalar(a + i, b + i, n - i);
+}
+
+// pcmpestri compares each byte of a block against up to 16 set bytes.
+__attribute__((target("sse4.2")))
+static long findByteSetSse42(const unsigned char *s, long n, const unsigned char *set, long setn)
+{
+    if (setn > 16)
+        return findByteSetScalar(s, n, set, setn);
+    unsigned char buf[16] = {};
+    if (setn > 0)
+        std::memcpy(buf, set, setn);
+    __m128i v = _mm_loadu_si128((const __m128i *)buf);
+    long i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+        int k = _mm_cmpestri(v, setn, x, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (k < 16)
+            return i + k;
+    }
+    long r = findByteSetScalar(s + i, n - i, set, setn);
+    return r < 0 ? -1 : i + r;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+static long countByteSse42(const unsigned char *s, long n, long byte)
+{
+    __m128i v = _mm_set1_epi8((char)byte);
+    long count = 0, i = 0;
+    for (; i + 16 <= n; i += 16)
+        count += _mm_popcnt_u32(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i)), v)));
+    return count + countByteScalar(s + i, n - i, byte);
+}
+
+// AVX2
+
+__attribute__((target("avx2")))
+static long memchrAvx2(const unsigned char *s, long n, long byte)
+{
+    __m256i v = _mm256_set1_epi8((char)byte);
+    long i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        unsigned m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i)), v));
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    long r = memchrScalar(s + i, n - i, byte);
+    return r < 0 ? -1 : i + r;
+}
+
+__attribute__((target("avx2")))
+static long memcmpAvx2(const unsigned char *a, const unsigned char *b, long n)
+{
+    long i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        unsigned m = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (m)
+        {
+            long k = i + __builtin_ctz(m);
+            return a[k] < b[k] ? -1 : 1;
+        }
+    }
+    return memcmpScalar(a + i, b + i, n - i);
+}
+
+// One compare per set byte, so only small sets (delimiters) use it.
+__attribute__((target("avx2")))
+static long findByteSetAvx2(const unsigned char *s, long n, const unsigned char *set, long setn)
+{
+    if (setn > 8)
+        return findByteSetSse42(s, n, set, setn);
+    if (setn <= 0)
+        return -1;
+    __m256i vs[8];
+    for (long k = 0; k < setn; k++)
+        vs[k] = _mm256_set1_epi8((char)set[k]);
+    long i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i hit = _mm256_cmpeq_epi8(x, vs[0]);
+        for (long k = 1; k < setn; k++)
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, vs[k]));
+        unsigned m = _mm256_movemask_epi8(hit);
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    long r = findByteSetScalar(s + i, n - i, set, setn);
+    return r < 0 ? -1 : i + r;
+}
+
+__attribute__((target("avx2,popcnt")))
+static long countByteAvx2(const unsigned char *s, long n, long byte)
+{
+    __m256i v = _mm256_set1_epi8((char)byte);
+    long count = 0, i = 0;
+    for (; i + 32 <= n; i += 32)
+        count += _mm_popcnt_u32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i)), v)));
+    return count + countByteScalar(s + i, n - i, byte);
+}
+
+#endif
+
+class ScanImpl
+{
+public:
+    ScanLevel level;
+    long (*memchr)(const unsigned char *, long, long);
+    long (*memcmp)(const unsigned char *, const unsigned char *, long);
+    long (*findByteSet)(const unsigned char *, long, const unsigned char *, long);
+    long (*countByte)(const unsigned char *, long, long);
+};
+
+static ScanImpl pick(ScanLevel want)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (want == ScanLevel::AVX2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        return {ScanLevel::AVX2, memchrAvx2, memcmpAvx2, findByteSetAvx2, countByteAvx2};
+    if (want >= ScanLevel::SSE42 && __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+        return {ScanLevel::SSE42, memchrSse42, memcmpSse42, findByteSetSse42, countByteSse42};
+#endif
+    return {ScanLevel::SCALAR, memchrScalar, memcmpScalar, findByteSetScalar, countByteScalar};
+}
+
+static ScanImpl impl = pick(ScanLevel::AVX2);
+
+// A byte outside 0..255 never equals a zero-extended @8 byte.
+static bool isByte(long b)
+{
+    return b >= 0 && b <= 255;
+}
+
+long scanMemchr(const unsigned char *s, long n, long byte)
+{
+    return n > 0 && isByte(byte) ? impl.memchr(s, n, byte) : -1;
+}
+
+long scanMemcmp(const unsigned char *a, const unsigned char *b, long n)
+{
+    return n > 0 ? impl.memcmp(a, b, n) : 0;
+}
+
+long scanFindByteSet(const unsigned char *s, long n, const unsigned char *set, long setn)
+{
+    return n > 0 && setn > 0 ? impl.findByteSet(s, n, set, setn) : -1;
+}
+
+long scanCountByte(const unsigned char *s, long n, long byte)
+{
+    return n > 0 && isByte(byte) ? impl.countByte(s, n, byte) : 0;
+}
+
+ScanLevel scanLevel()
+{
+    return impl.level;
+}
+
+const char *scanLevelName(ScanLevel level)
+{
+    switch (level)
+    {
+        case ScanLevel::AVX2: return "avx2";
+        case ScanLevel::SSE42: return "sse4.2";
+        default: return "scalar";
+    }
+}
+
+void setScanLevel(ScanLevel level)
+{
+    impl = pick(level);
+}
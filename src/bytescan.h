@@ -0,0 +1,30 @@
+#ifndef CPPORTH_BYTESCAN_H
+#define CPPORTH_BYTESCAN_H
+
+// Porth++ byte builtins memchr, memcmp, find-byte-set and count-byte. Each
+// has a scalar version and, on x86-64, SSE4.2 and AVX2 versions; the best
+// one the CPU supports is picked when the program starts. Lengths <= 0 are
+// empty buffers.
+enum class ScanLevel
+{
+    SCALAR,
+    SSE42,
+    AVX2
+};
+
+// Index of the first byte in s[0, n) equal to byte, or -1.
+long scanMemchr(const unsigned char *s, long n, long byte);
+// -1, 0 or 1 as a[0, n) compares below, equal or above b[0, n), bytewise.
+long scanMemcmp(const unsigned char *a, const unsigned char *b, long n);
+// Index of the first byte in s[0, n) that is one of set[0, setn), or -1.
+long scanFindByteSet(const unsigned char *s, long n, const unsigned char *set, long setn);
+// Number of bytes in s[0, n) equal to byte.
+long scanCountByte(const unsigned char *s, long n, long byte);
+
+ScanLevel scanLevel();
+const char *scanLevelName(ScanLevel);
+// Switches implementation, e.g. to compare them in tests. Levels the CPU
+// does not support fall back to the best one it does.
+void setScanLevel(ScanLevel);
+
+#endif // CPPORTH_BYTESCAN_H
@@ -0,0 +1,775 @@
+#include "codegen.h"
+#include "optimizer.h"
+#include "helper.h"
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+
+static const long RET_STACK_CELLS = 1 << 17;
+
+// Emits one proc at a time. Let/peek/match bindings live on the return
+// stack: a group of k names bound while `depth` cells were in use occupies
+// the next k cells, so a name's address is ret_stack_rsp plus the cells
+// bound after it. Local `memory` sits in a frame reserved on proc entry,
+// between the bindings and the return address.
+class AsmEmitter
+{
+public:
+    Env& env;
+    std::ostream& out;
+    std::map<std::string, int> strings;
+    std::vector<std::pair<Symbol, int> > names;     // binding -> cell index, innermost last
+    std::unordered_map<Symbol, long> memory;        // local memory -> frame offset
+    long frame = 0;
+    int depth = 0;
+    int labels = 0;
+
+    AsmEmitter(Env&, std::ostream&);
+    int label();
+    std::string str(const std::string&);
+    std::string immediate(long);
+    void push(long);
+    void pushString(const std::string&, bool);
+    void fail(const std::string&);
+    void call(const std::string&);
+    void bind(const std::vector<Symbol>&, const std::vector<Expr*>&);
+    void unbind(size_t);
+    void isolated(const std::vector<Expr*>&);
+    void test(OpKind, int);
+    void emitProc(ProcCmd *);
+    void emit(const std::vector<Expr*>&);
+    void emit(Expr *);
+    void emitIf(IfExpr *);
+    void emitWhile(WhileExpr *);
+    void emitOp(OpExpr *);
+    void emitSuper(SuperExpr *);
+    void emitMatch(MatchExpr *);
+};
+
+AsmEmitter::AsmEmitter(Env& env, std::ostream& out) : env(env), out(out) {;}
+
+int AsmEmitter::label()
+{
+    return labels++;
+}
+
+static std::string procLabel(ProcCmd *proc)
+{
+    return "proc_" + std::to_string(proc->id);
+}
+
+static const char *setcc(OpKind kind)
+{
+    switch (kind)
+    {
+        case OpKind::LT: return "setl";
+        case OpKind::GT: return "setg";
+        case OpKind::LE: return "setle";
+        case OpKind::GE: return "setge";
+        case OpKind::EQ: return "sete";
+        default: return "setne";
+    }
+}
+
+// Jump taken when the comparison is false.
+static const char *jumpUnless(OpKind kind)
+{
+    switch (kind)
+    {
+        case OpKind::LT: return "jge";
+        case OpKind::GT: return "jle";
+        case OpKind::LE: return "jg";
+        case OpKind::GE: return "jl";
+        case OpKind::EQ: return "jne";
+        default: return "je";
+    }
+}
+
+// Label of a string literal in .data, shared between identical strings.
+std::string AsmEmitter::str(const std::string& s)
+{
+    auto it = strings.find(s);
+    if (it == strings.end())
+        it = strings.insert(std::make_pair(s, (int)strings.size())).first;
+    return "str_" + std::to_string(it->second);
+}
+
+// Folded values are host addresses when they point into a global memory
+// block; those become the block's .bss symbol plus the offset.
+std::string AsmEmitter::immediate(long value)
+{
+    auto& regions = globalMemory();
+    for (int pass = 0; pass < 2; pass++)
+        for (size_t i = 0; i < regions.size(); i++)
+        {
+            long off = value - regions[i].addr;
+            if (off >= 0 && (off < regions[i].size || (pass == 1 && off == regions[i].size)))
+                return "mem_" + std::to_string(i) + (off ? "+" + std::to_string(off) : "");
+        }
+    return "";
+}
+
+void AsmEmitter::push(long value)
+{
+    auto sym = immediate(value);
+    if (!sym.empty())
+        out << "    lea rax, [rip+" << sym << "]\n    push rax\n";
+    else if (value >= INT32_MIN && value <= INT32_MAX)
+        out << "    push " << value << "\n";
+    else
+        out << "    movabs rax, " << value << "\n    push rax\n";
+}
+
+void AsmEmitter::pushString(const std::string& s, bool cstr)
+{
+    if (!cstr)
+        out << "    push " << s.size() << "\n";
+    out << "    lea rax, [rip+" << str(s) << "]\n    push rax\n";
+}
+
+// Prints msg to stdout and exits with status 1, like the interpreter's errors.
+void AsmEmitter::fail(const std::string& msg)
+{
+    out << "    lea rsi, [rip+" << str(msg + "\n") << "]\n";
+    out << "    mov rdx, " << msg.size() + 1 << "\n";
+    out << "    jmp porth_fail\n";
+}
+
+// Switches rsp to the return stack around the call, as original Porth does.
+void AsmEmitter::call(const std::string& target)
+{
+    out << "    mov rax, rsp\n";
+    out << "    mov rsp, [rip+ret_stack_rsp]\n";
+    out << "    call " << target << "\n";
+    out << "    mov [rip+ret_stack_rsp], rsp\n";
+    out << "    mov rsp, rax\n";
+}
+
+// Pops idents.size() cells into new return stack cells and emits body with
+// them in scope. The cells are already on the data stack for let and match.
+void AsmEmitter::bind(const std::vector<Symbol>& idents, const std::vector<Expr*>& body)
+{
+    size_t n = idents.size();
+    out << "    mov rax, [rip+ret_stack_rsp]\n";
+    out << "    sub rax, " << n * 8 << "\n";
+    out << "    mov [rip+ret_stack_rsp], rax\n";
+    for (int i = n-1; i >= 0; i--)
+        out << "    pop rbx\n    mov [rax+" << i * 8 << "], rbx\n";
+
+    for (size_t i = 0; i < n; i++)
+        names.push_back(std::make_pair(idents[i], depth + (int)(n - i) - 1));
+    depth += n;
+    emit(body);
+    unbind(n);
+}
+
+void AsmEmitter::unbind(size_t n)
+{
+    out << "    add qword ptr [rip+ret_stack_rsp], " << n * 8 << "\n";
+    depth -= n;
+    names.resize(names.size() - n);
+}
+
+// Runs exps on top of the current stack and leaves only their top cell in
+// rax, like interpExpr on a fresh Stack. The old rsp is saved on the return stack.
+void AsmEmitter::isolated(const std::vector<Expr*>& exps)
+{
+    out << "    mov rax, [rip+ret_stack_rsp]\n";
+    out << "    sub rax, 8\n";
+    out << "    mov [rip+ret_stack_rsp], rax\n";
+    out << "    mov [rax], rsp\n";
+    depth++;
+    emit(exps);
+    depth--;
+    out << "    mov rbx, [rip+ret_stack_rsp]\n";
+    out << "    mov rax, [rsp]\n";
+    out << "    mov rsp, [rbx]\n";
+    out << "    add qword ptr [rip+ret_stack_rsp], 8\n";
+}
+
+// Pops an if/while test and jumps to .L<target> when it fails.
+void AsmEmitter::test(OpKind cmp, int target)
+{
+    if (cmp != OpKind::UNKNOWN)
+    {
+        out << "    pop rbx\n    pop rax\n    cmp rax, rbx\n";
+        out << "    " << jumpUnless(cmp) << " .L" << target << "\n";
+        return;
+    }
+    out << "    pop rax\n    test rax, rax\n    jz .L" << target << "\n";
+}
+
+void AsmEmitter::emitProc(ProcCmd *proc)
+{
+    if (!proc->library.empty())
+    {
+        std::cout << "CompileError:" << proc->line << ": not supported by the asm target: extern " << proc->name << std::endl;
+        throw new std::exception();
+    }
+    auto& body = proc->getBody();
+
+    memory.clear();
+    frame = 0;
+    walkBodies(body, [&](std::vector<Expr*>& list, std::vector<Symbol>&) {
+        for (auto e : list)
+        {
+            if (e->getASTKind() != ASTKind::MEMORYEXPR)
+                continue;
+            auto m = (MemoryExpr *)e;
+            Stack s;
+            long size = interpExpr(m->body, s, env).getValue();
+            memory[m->sym] = frame;
+            frame += (size + 7) / 8 * 8;
+        }
+    });
+
+    out << "\n# proc " << proc->name << "\n";
+    out << procLabel(proc) << ":\n";
+    if (frame)
+        out << "    sub rsp, " << frame << "\n";
+    out << "    mov [rip+ret_stack_rsp], rsp\n";
+    out << "    mov rsp, rax\n";
+    emit(body);
+    out << "    mov rax, rsp\n";
+    out << "    mov rsp, [rip+ret_stack_rsp]\n";
+    if (frame)
+        out << "    add rsp, " << frame << "\n";
+    out << "    ret\n";
+}
+
+void AsmEmitter::emit(const std::vector<Expr*>& exps)
+{
+    for (auto e : exps)
+        emit(e);
+}
+
+void AsmEmitter::emit(Expr *exp)
+{
+    switch (exp->getASTKind())
+    {
+        case ASTKind::INTEXPR:
+            push(((IntExpr *)exp)->getValue());
+            break;
+
+        case ASTKind::IMMEXPR:
+            push(((ImmExpr *)exp)->value);
+            break;
+
+        case ASTKind::CHAREXPR:
+            push((long)((CharExpr *)exp)->getValue());
+            break;
+
+        case ASTKind::TRUEEXPR:
+            push(1);
+            break;
+
+        case ASTKind::FALSEEXPR:
+            push(0);
+            break;
+
+        case ASTKind::STRINGLITEXPR:
+        {
+            auto s = (StringLitExpr *)exp;
+            pushString(realString(s->getValue()), s->isCStr());
+            break;
+        }
+
+        case ASTKind::HEREEXPR:
+            pushString(env.filepath + ":" + std::to_string(exp->line), false);
+            break;
+
+        case ASTKind::VAREXPR:
+        {
+            auto v = (VarExpr *)exp;
+            static const Symbol argc = intern("argc");
+            static const Symbol argv = intern("argv");
+
+            if (env.isProc(v->sym))
+            {
+                call(procLabel(env.getProc(v->sym)));
+                break;
+            }
+
+            auto name = std::find_if(names.rbegin(), names.rend(),
+                [&](auto& n) { return n.first == v->sym; });
+            if (name != names.rend())
+            {
+                out << "    mov rax, [rip+ret_stack_rsp]\n";
+                out << "    push qword ptr [rax+" << (depth - 1 - name->second) * 8 << "]\n";
+            }
+            else if (memory.count(v->sym))
+            {
+                out << "    mov rax, [rip+ret_stack_rsp]\n";
+                out << "    lea rax, [rax+" << depth * 8 + memory[v->sym] << "]\n";
+                out << "    push rax\n";
+            }
+            else if (v->sym == argc)
+                out << "    mov rax, [rip+args_ptr]\n    push qword ptr [rax]\n";
+            else if (v->sym == argv)
+                out << "    mov rax, [rip+args_ptr]\n    add rax, 8\n    push rax\n";
+            else if (env.isVariable(v->sym))
+                push(env.getVar(v->sym).getValue());
+            else
+            {
+                std::cout << "CompileError:" << exp->line << ": Unknown identifier encountered: '" << symbolName(v->sym) << "'\n";
+                throw new std::exception();
+            }
+            break;
+        }
+
+        case ASTKind::ADDROFEXPR:
+        {
+            auto a = (AddrOfExpr *)exp;
+            if (!env.isProc(a->proc->sym))
+            {
+                std::cout << "CompileError:" << exp->line << ": addr-of: procedure does not exist: '" << symbolName(a->proc->sym) << "'\n";
+                throw new std::exception();
+            }
+            out << "    lea rax, [rip+" << procLabel(env.getProc(a->proc->sym)) << "]\n    push rax\n";
+            break;
+        }
+
+        case ASTKind::CALLLIKEEXPR:
+            out << "    pop rcx\n";
+            call("rcx");
+            break;
+
+        case ASTKind::MEMORYEXPR:
+            // Reserved in the proc's frame by emitProc.
+            break;
+
+        case ASTKind::WHILEEXPR:
+            emitWhile((WhileExpr *)exp);
+            break;
+
+        case ASTKind::IFEXPR:
+            emitIf((IfExpr *)exp);
+            break;
+
+        case ASTKind::LETSTMT:
+        {
+            auto let = (LetExpr *)exp;
+            bind(let->idents, let->body);
+            break;
+        }
+
+        case ASTKind::PEEKSTMT:
+        {
+            auto peek = (PeekExpr *)exp;
+            size_t n = peek->idents.size();
+            for (size_t i = 0; i < n; i++)
+                out << "    push qword ptr [rsp+" << (n - 1) * 8 << "]\n";
+            bind(peek->idents, peek->body);
+            break;
+        }
+
+        case ASTKind::MATCHSTMT:
+            emitMatch((MatchExpr *)exp);
+            break;
+
+        case ASTKind::ASSERTEXPR:
+        {
+            auto a = (AssertExpr *)exp;
+            int ok = label();
+            isolated(a->body);
+            out << "    test rax, rax\n    jnz .L" << ok << "\n";
+            fail(env.filepath + ":" + std::to_string(a->line) + ": AssertionError: " + realString(a->msg));
+            out << ".L" << ok << ":\n";
+            break;
+        }
+
+        case ASTKind::ALLOCSTMT:
+            out << "    pop rdi\n    call porth_alloc\n    push rax\n";
+            break;
+
+        case ASTKind::FREEEXPR:
+            out << "    pop rdi\n    call porth_free\n";
+            break;
+
+        case ASTKind::VARIANTINSTANCEEXPR:
+        {
+            // Cell 0 is the variant's symbol, the values follow.
+            auto n = (VariantInstanceExpr *)exp;
+            out << "    mov rdi, " << (n->args.size() + 1) * 8 << "\n    call porth_alloc\n";
+            out << "    mov qword ptr [rax], " << n->variantSym << "\n    push rax\n";
+            for (size_t i = 0; i < n->args.size(); i++)
+            {
+                isolated(n->args[i]);
+                out << "    mov rbx, [rsp]\n    mov [rbx+" << (i + 1) * 8 << "], rax\n";
+            }
+            break;
+        }
+
+        case ASTKind::SYSCALLEXPR:
+        {
+            static const char *regs[] = {"rdi", "rsi", "rdx", "r10", "r8", "r9"};
+            auto s = (SyscallExpr *)exp;
+            out << "    pop rax\n";
+            for (int i = 0; i < s->getNumArgs(); i++)
+                out << "    pop " << regs[i] << "\n";
+            out << "    syscall\n    push rax\n";
+            break;
+        }
+
+        case ASTKind::PRINTEXPR:
+            out << "    pop rdi\n    call porth_print\n";
+            break;
+
+        case ASTKind::MAXEXPR:
+            out << "    pop rbx\n    pop rax\n    cmp rax, rbx\n    cmovl rax, rbx\n    push rax\n";
+            break;
+
+        case ASTKind::DROPEXPR:
+            out << "    add rsp, 8\n";
+            break;
+
+        case ASTKind::DUPEXPR:
+            out << "    push qword ptr [rsp]\n";
+            break;
+
+        case ASTKind::OVEREXPR:
+            out << "    push qword ptr [rsp+8]\n";
+            break;
+
+        case ASTKind::SWAPEXPR:
+            out << "    pop rax\n    pop rbx\n    push rax\n    push rbx\n";
+            break;
+
+        case ASTKind::ROTEXPR:
+            out << "    pop rax\n    pop rbx\n    pop rcx\n    push rbx\n    push rax\n    push rcx\n";
+            break;
+
+        case ASTKind::PERMUTEEXPR:
+        {
+            auto p = (PermuteExpr *)exp;
+            for (int i = 0; i < p->depth; i++)
+                out << "    mov rax, [rsp+" << (p->depth - 1 - i) * 8 << "]\n"
+                    << "    mov [rip+permute_tmp+" << i * 8 << "], rax\n";
+            out << "    add rsp, " << p->depth * 8 << "\n";
+            for (int i : p->order)
+                out << "    push qword ptr [rip+permute_tmp+" << i * 8 << "]\n";
+            break;
+        }
+
+        case ASTKind::OPEXPR:
+            emitOp((OpExpr *)exp);
+            break;
+
+        case ASTKind::SUPEREXPR:
+            emitSuper((SuperExpr *)exp);
+            break;
+
+        default:
+            std::cout << "CompileError:" << exp->line << ": not supported by the asm target: " << exp->toString() << std::endl;
+            throw new std::exception();
+    }
+}
+
+void AsmEmitter::emitIf(IfExpr *f)
+{
+    int elze = label();
+    int end = label();
+    test(f->cmp, elze);
+    emit(f->then);
+    out << "    jmp .L" << end << "\n";
+    out << ".L" << elze << ":\n";
+    if (f->elze.size() != 0)
+    {
+        emit(f->elze);
+        if (f->next)
+            emitIf(f->next);
+    }
+    out << ".L" << end << ":\n";
+}
+
+void AsmEmitter::emitWhile(WhileExpr *w)
+{
+    int cond = label();
+    int end = label();
+    out << ".L" << cond << ":\n";
+    emit(w->cond);
+    test(w->cmp, end);
+    emit(w->body);
+    out << "    jmp .L" << cond << "\n";
+    out << ".L" << end << ":\n";
+}
+
+void AsmEmitter::emitOp(OpExpr *op)
+{
+    switch (op->kind)
+    {
+        case OpKind::ADD:
+            out << "    pop rbx\n    add [rsp], rbx\n";
+            break;
+        case OpKind::SUB:
+            out << "    pop rbx\n    sub [rsp], rbx\n";
+            break;
+        case OpKind::MUL:
+            out << "    pop rbx\n    pop rax\n    imul rax, rbx\n    push rax\n";
+            break;
+        // The interpreter's divmod is C's signed / and %.
+        case OpKind::DIVMOD:
+        case OpKind::IDIVMOD:
+            out << "    pop rbx\n    pop rax\n    cqo\n    idiv rbx\n    push rax\n    push rdx\n";
+            break;
+        case OpKind::LT:
+        case OpKind::GT:
+        case OpKind::LE:
+        case OpKind::GE:
+        case OpKind::EQ:
+        case OpKind::NE:
+            out << "    pop rbx\n    pop rax\n    xor ecx, ecx\n    cmp rax, rbx\n";
+            out << "    " << setcc(op->kind) << " cl\n    push rcx\n";
+            break;
+        case OpKind::SHR:
+            out << "    pop rcx\n    sar qword ptr [rsp], cl\n";
+            break;
+        case OpKind::SHL:
+            out << "    pop rcx\n    shl qword ptr [rsp], cl\n";
+            break;
+        case OpKind::OR:
+            out << "    pop rbx\n    or [rsp], rbx\n";
+            break;
+        case OpKind::AND:
+            out << "    pop rbx\n    and [rsp], rbx\n";
+            break;
+        case OpKind::NOT:
+            out << "    not qword ptr [rsp]\n";
+            break;
+        case OpKind::STORE8:
+            out << "    pop rax\n    pop rbx\n    mov [rax], bl\n";
+            break;
+        case OpKind::STORE16:
+            out << "    pop rax\n    pop rbx\n    mov [rax], bx\n";
+            break;
+        case OpKind::STORE32:
+            out << "    pop rax\n    pop rbx\n    mov [rax], ebx\n";
+            break;
+        case OpKind::STORE64:
+            out << "    pop rax\n    pop rbx\n    mov [rax], rbx\n";
+            break;
+        case OpKind::LOAD8:
+            out << "    pop rax\n    movzx eax, byte ptr [rax]\n    push rax\n";
+            break;
+        case OpKind::LOAD16:
+            out << "    pop rax\n    movzx eax, word ptr [rax]\n    push rax\n";
+            break;
+        case OpKind::LOAD32:
+            out << "    pop rax\n    mov eax, [rax]\n    push rax\n";
+            break;
+        case OpKind::LOAD64:
+            out << "    pop rax\n    push qword ptr [rax]\n";
+            break;
+        case OpKind::CASTBOOL:
+            out << "    pop rax\n    xor ecx, ecx\n    test rax, rax\n    setg cl\n    push rcx\n";
+            break;
+        default:
+            // cast(int) and cast(ptr) only change the interpreter's type tag.
+            break;
+    }
+}
+
+void AsmEmitter::emitSuper(SuperExpr *s)
+{
+    switch (s->kind)
+    {
+        case SuperKind::ADDIMM:
+        {
+            // i buf + folds buf's host address into the immediate
+            auto sym = immediate(s->imm);
+            if (!sym.empty())
+                out << "    lea rax, [rip+" << sym << "]\n    add [rsp], rax\n";
+            else if (s->imm >= INT32_MIN && s->imm <= INT32_MAX)
+                out << "    add qword ptr [rsp], " << s->imm << "\n";
+            else
+                out << "    movabs rax, " << s->imm << "\n    add [rsp], rax\n";
+            break;
+        }
+        case SuperKind::DUPLOAD8:
+            out << "    mov rax, [rsp]\n    movzx eax, byte ptr [rax]\n    push rax\n";
+            break;
+        case SuperKind::DUPLOAD64:
+            out << "    mov rax, [rsp]\n    push qword ptr [rax]\n";
+            break;
+        case SuperKind::OVEROVERCMP:
+            out << "    mov rax, [rsp+8]\n    xor ecx, ecx\n    cmp rax, [rsp]\n";
+            out << "    " << setcc(s->cmp) << " cl\n    push rcx\n";
+            break;
+        case SuperKind::SWAPSTORE8:
+            out << "    pop rbx\n    pop rax\n    mov [rax], bl\n";
+            break;
+        case SuperKind::SWAPSTORE64:
+            out << "    pop rbx\n    pop rax\n    mov [rax], rbx\n";
+            break;
+    }
+}
+
+void AsmEmitter::emitMatch(MatchExpr *m)
+{
+    static const Symbol elseSym = intern("else");
+    int end = label();
+
+    out << "    pop rsi\n";
+    for (auto& [name, branch] : m->branches)
+    {
+        if (name == elseSym)
+            continue;
+        int next = label();
+        out << "    cmp qword ptr [rsi], " << name << "\n    jne .L" << next << "\n";
+        for (size_t i = 0; i < branch->idents.size(); i++)
+            out << "    push qword ptr [rsi+" << (i + 1) * 8 << "]\n";
+        bind(branch->idents, branch->body);
+        out << "    jmp .L" << end << "\n";
+        out << ".L" << next << ":\n";
+    }
+
+    auto elze = m->branches.find(elseSym);
+    if (elze != m->branches.end())
+    {
+        auto branch = elze->second;
+        for (size_t i = 0; i < branch->idents.size(); i++)
+            out << "    push qword ptr [rsi+" << (i + 1) * 8 << "]\n";
+        bind(branch->idents, branch->body);
+    }
+    else
+        fail(env.filepath + ":" + std::to_string(m->line) + ": RuntimeError: match: no branch for variant");
+    out << ".L" << end << ":\n";
+}
+
+// Runtime support: print, alloc/free on mmap, and the error exit.
+static const char *prelude = R"(
+porth_print:
+    sub rsp, 40
+    lea rsi, [rsp+39]
+    mov byte ptr [rsi], 10
+    mov rax, rdi
+    mov r8, rdi
+    test rax, rax
+    jns 1f
+    neg rax
+1:
+    mov rcx, 10
+2:
+    xor edx, edx
+    div rcx
+    add dl, '0'
+    dec rsi
+    mov [rsi], dl
+    test rax, rax
+    jnz 2b
+    test r8, r8
+    jns 3f
+    dec rsi
+    mov byte ptr [rsi], '-'
+3:
+    lea rdx, [rsp+40]
+    sub rdx, rsi
+    mov eax, 1
+    mov edi, 1
+    syscall
+    add rsp, 40
+    ret
+
+porth_alloc:
+    lea rsi, [rdi+8]
+    push rsi
+    xor edi, edi
+    mov edx, 3
+    mov r10d, 0x22
+    mov r8, -1
+    xor r9d, r9d
+    mov eax, 9
+    syscall
+    pop rsi
+    mov [rax], rsi
+    add rax, 8
+    ret
+
+porth_free:
+    sub rdi, 8
+    mov rsi, [rdi]
+    mov eax, 11
+    syscall
+    ret
+
+porth_fail:
+    mov eax, 1
+    mov edi, 1
+    syscall
+    mov eax, 60
+    mov edi, 1
+    syscall
+)";
+
+static void emitBytes(std::ostream& out, const std::string& s)
+{
+    out << "    .byte ";
+    for (size_t i = 0; i < s.size(); i++)
+        out << (int)(unsigned char)s[i] << ", ";
+    out << "0\n";
+}
+
+void emitAsm(Env& env, std::ostream& out)
+{
+    AsmEmitter a(env, out);
+
+    out << ".intel_syntax noprefix\n";
+    out << ".text\n";
+    out << ".globl _start\n";
+    out << "_start:\n";
+    out << "    mov [rip+args_ptr], rsp\n";
+    out << "    lea rax, [rip+ret_stack_end]\n";
+    out << "    mov [rip+ret_stack_rsp], rax\n";
+    a.call(procLabel(env.getProc("main")));
+    out << "    mov eax, 60\n";
+    out << "    xor edi, edi\n";
+    out << "    syscall\n";
+    out << prelude;
+
+    for (auto& [name, proc] : env.procs)
+        a.emitProc(proc);
+
+    out << "\n.data\n";
+    std::vector<const std::string*> strs(a.strings.size());
+    for (auto& [s, i] : a.strings)
+        strs[i] = &s;
+    for (size_t i = 0; i < strs.size(); i++)
+    {
+        out << "str_" << i << ":\n";
+        emitBytes(out, *strs[i]);
+    }
+
+    out << "\n.bss\n";
+    out << ".align 8\n";
+    out << "args_ptr: .zero 8\n";
+    out << "ret_stack_rsp: .zero 8\n";
+    out << "permute_tmp: .zero " << PermuteExpr::MAX_DEPTH * 8 << "\n";
+    auto& regions = globalMemory();
+    for (size_t i = 0; i < regions.size(); i++)
+        out << "mem_" << i << ": .zero " << (regions[i].size + 7) / 8 * 8 << "    # " << regions[i].name << "\n";
+    out << "ret_stack: .zero " << RET_STACK_CELLS * 8 << "\n";
+    out << "ret_stack_end:\n";
+}
+
+bool compileAsm(Env& env, const std::string& base)
+{
+    {
+        std::ofstream file(base + ".s");
+        if (!file.is_open())
+        {
+            std::cout << "Could not open file " << base << ".s" << std::endl;
+            return false;
+        }
+        emitAsm(env, file);
+    }
+
+    std::string as = "as -o " + base + ".o " + base + ".s";
+    std::string ld = "ld -static -o " + base + " " + base + ".o";
+    std::cout << "[CMD] " << as << std::endl;
+    if (std::system(as.c_str()) != 0)
+        return false;
+    std::cout << "[CMD] " << ld << std::endl;
+    return std::system(ld.c_str()) == 0;
+}
@@ -0,0 +1,20 @@
+#ifndef CPPORTH_CODEGEN_H
+#define CPPORTH_CODEGEN_H
+
+#include <ostream>
+#include "runtime.h"
+
+// x86-64 Linux backend (cpporth compile --target=asm).
+// Follows original Porth's model: rsp is the data stack, calls and let
+// bindings live on a separate return stack in .bss, global memory and
+// strings are .bss/.data symbols and syscalls are the syscall instruction.
+// The output is GNU as (intel syntax) for a static ELF without libc.
+
+// Writes assembly for every proc in env, with _start calling main.
+void emitAsm(Env&, std::ostream&);
+
+// Writes <base>.s and assembles and links it into the executable <base>
+// with the system as and ld. Returns false if either fails.
+bool compileAsm(Env&, const std::string& base);
+
+#endif // CPPORTH_CODEGEN_H
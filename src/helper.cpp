@@ -1,11 +1,13 @@
 #include "helper.h"
 #include "lexer.h"
 #include "parser.h"
+#include "profiler.h"
 #include <fstream>
 #include <iostream>
 
 std::string openFile(std::string path)
 {
+    TraceScope trace("openFile " + path);
     std::string buf;
     std::ifstream file;
 
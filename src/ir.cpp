@@ -0,0 +1,1598 @@
+#include "ir.h"
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <map>
+#include <tuple>
+#include <unordered_set>
+#include "syscalls.h"
+#include "optimizer.h"
+#include "profiler.h"
+#include "memcheck.h"
+#include "args.h"
+
+// LOWERING
+
+// Abstract interpretation of a proc body: the stack holds the register of
+// each cell, so shuffles and let/peek cost nothing and ops read their
+// operands directly. Anything outside the supported subset fails the proc,
+// which then keeps running on the tree interpreter.
+class Lowerer
+{
+public:
+    Env& env;
+    const std::unordered_set<ProcCmd*>& callable;
+    IRFunc *fn;
+    int cur = 0;
+    std::vector<int> stack;
+    std::vector<std::pair<Symbol, int> > names;     // let/peek bindings, innermost last
+    std::vector<Symbol> *baked = nullptr;           // receives env variables lowered as constants
+
+    Lowerer(Env&, const std::unordered_set<ProcCmd*>&, IRFunc *);
+    int newBlock();
+    IRInst& emit(IROp, OpKind, const std::vector<int>&, int);
+    int value(IROp, OpKind, const std::vector<int>&, int);
+    int constant(Data, int);
+    void jump(int, int);
+    void branch(IRInst, int, int);
+    bool take(size_t, std::vector<int>&);
+    bool test(OpKind, bool, int, IRInst&);
+    bool merge(int, const std::vector<int>&);
+    bool bind(const std::vector<Symbol>&, const std::vector<int>&, const std::vector<Expr*>&);
+    bool call(ProcCmd *, int);
+    bool lower(const std::vector<Expr*>&);
+    bool lower(Expr *);
+    bool lowerIf(IfExpr *);
+    bool lowerWhile(WhileExpr *);
+    bool lowerOp(OpExpr *);
+    bool lowerSuper(SuperExpr *);
+};
+
+Lowerer::Lowerer(Env& env, const std::unordered_set<ProcCmd*>& callable, IRFunc *fn) :
+    env(env), callable(callable), fn(fn) {;}
+
+int Lowerer::newBlock()
+{
+    fn->blocks.emplace_back();
+    return fn->blocks.size() - 1;
+}
+
+IRInst& Lowerer::emit(IROp op, OpKind kind, const std::vector<int>& args, int line)
+{
+    IRInst i;
+    i.op = op;
+    i.kind = kind;
+    i.args = args;
+    i.line = line;
+    fn->blocks[cur].insts.push_back(i);
+    return fn->blocks[cur].insts.back();
+}
+
+int Lowerer::value(IROp op, OpKind kind, const std::vector<int>& args, int line)
+{
+    int r = fn->regs++;
+    emit(op, kind, args, line).defs.push_back(r);
+    return r;
+}
+
+int Lowerer::constant(Data d, int line)
+{
+    int r = fn->regs++;
+    auto& i = emit(IROp::CONST, OpKind::UNKNOWN, {}, line);
+    i.imm = d;
+    i.defs.push_back(r);
+    return r;
+}
+
+void Lowerer::jump(int from, int to)
+{
+    IRInst i;
+    i.op = IROp::JMP;
+    i.target = to;
+    fn->blocks[from].insts.push_back(i);
+    fn->blocks[to].preds.push_back(from);
+}
+
+void Lowerer::branch(IRInst term, int t, int f)
+{
+    term.target = t;
+    term.target2 = f;
+    fn->blocks[cur].insts.push_back(term);
+    fn->blocks[t].preds.push_back(cur);
+    fn->blocks[f].preds.push_back(cur);
+}
+
+// Pops the top n cells, deepest first.
+bool Lowerer::take(size_t n, std::vector<int>& out)
+{
+    if (stack.size() < n)
+        return false;
+    out.assign(stack.end() - n, stack.end());
+    stack.resize(stack.size() - n);
+    return true;
+}
+
+// Builds the terminator for an if/while test: a compare-and-branch when the
+// comparison was fused into the branch, else a branch on a bool.
+bool Lowerer::test(OpKind cmp, bool expectBool, int line, IRInst& term)
+{
+    term.line = line;
+    if (cmp != OpKind::UNKNOWN)
+    {
+        term.op = IROp::BRCMP;
+        term.kind = cmp;
+        return take(2, term.args);
+    }
+    term.op = IROp::BR;
+    term.expectBool = expectBool;
+    return take(1, term.args);
+}
+
+// Joins the current path with one that ended in block other with stack
+// otherStack. Both must leave the same number of cells.
+bool Lowerer::merge(int other, const std::vector<int>& otherStack)
+{
+    if (otherStack.size() != stack.size())
+        return false;
+    int join = newBlock();
+    jump(other, join);
+    jump(cur, join);
+    for (size_t k = 0; k < stack.size(); k++)
+    {
+        if (otherStack[k] == stack[k])
+            continue;
+        IRInst phi;
+        phi.op = IROp::PHI;
+        phi.args = {otherStack[k], stack[k]};
+        phi.defs = {fn->regs++};
+        fn->blocks[join].insts.push_back(phi);
+        stack[k] = phi.defs[0];
+    }
+    cur = join;
+    return true;
+}
+
+// The interpreter never rebinds a name that is already a variable, so shadowing
+// is rejected here rather than modelled.
+bool Lowerer::bind(const std::vector<Symbol>& idents, const std::vector<int>& values, const std::vector<Expr*>& body)
+{
+    static const Symbol underscore = intern("_");
+    size_t mark = names.size();
+    for (size_t i = 0; i < idents.size(); i++)
+    {
+        if (idents[i] == underscore)
+            continue;
+        if (env.variables.count(idents[i]))
+            return false;
+        for (auto& [name, r] : names)
+            if (name == idents[i])
+                return false;
+        names.push_back(std::make_pair(idents[i], values[i]));
+    }
+    bool ok = lower(body);
+    names.resize(mark);
+    return ok;
+}
+
+bool Lowerer::call(ProcCmd *proc, int line)
+{
+    std::vector<int> args;
+    bool native = proc->native || proc->thunk;
+    if ((!native && !callable.count(proc)) || !take(proc->sig.params.size(), args))
+        return false;
+    auto& i = emit(native ? IROp::NATIVE : IROp::CALL, OpKind::UNKNOWN, args, line);
+    i.callee = proc;
+    for (size_t k = 0; k < proc->sig.retTypes.size(); k++)
+        i.defs.push_back(fn->regs++);
+    stack.insert(stack.end(), i.defs.begin(), i.defs.end());
+    return true;
+}
+
+bool Lowerer::lower(const std::vector<Expr*>& exps)
+{
+    for (auto e : exps)
+        if (!lower(e))
+            return false;
+    return true;
+}
+
+bool Lowerer::lower(Expr *exp)
+{
+    std::vector<int> in;
+    switch (exp->getASTKind())
+    {
+        case ASTKind::INTEXPR:
+            stack.push_back(constant(Data(((IntExpr *)exp)->getValue(), TypeKind::INT), exp->line));
+            return true;
+
+        case ASTKind::IMMEXPR:
+        {
+            auto i = (ImmExpr *)exp;
+            stack.push_back(constant(Data(i->value, i->type), exp->line));
+            return true;
+        }
+
+        case ASTKind::CHAREXPR:
+            stack.push_back(constant(Data((long)((CharExpr *)exp)->getValue(), TypeKind::INT), exp->line));
+            return true;
+
+        case ASTKind::VAREXPR:
+        {
+            auto v = (VarExpr *)exp;
+            if (auto proc = env.procs.find(v->sym); proc != env.procs.end())
+                return call(proc->second, exp->line);
+            if (auto var = env.variables.find(v->sym); var != env.variables.end())
+            {
+                if (baked)
+                    baked->push_back(v->sym);
+                stack.push_back(constant(var->second, exp->line));
+                return true;
+            }
+            for (int i = names.size()-1; i >= 0; i--)
+                if (names[i].first == v->sym)
+                {
+                    stack.push_back(names[i].second);
+                    return true;
+                }
+            return false;
+        }
+
+        case ASTKind::OPEXPR:
+            return lowerOp((OpExpr *)exp);
+
+        case ASTKind::SUPEREXPR:
+            return lowerSuper((SuperExpr *)exp);
+
+        case ASTKind::MAXEXPR:
+            if (!take(2, in))
+                return false;
+            stack.push_back(value(IROp::MAX, OpKind::UNKNOWN, in, exp->line));
+            return true;
+
+        case ASTKind::PRINTEXPR:
+            if (!take(1, in))
+                return false;
+            emit(IROp::PRINT, OpKind::UNKNOWN, in, exp->line);
+            return true;
+
+        case ASTKind::SYSCALLEXPR:
+        {
+            // number on top, then arg0, arg1, ... below it
+            int n = ((SyscallExpr *)exp)->getNumArgs();
+            if (!take(n + 1, in))
+                return false;
+            std::reverse(in.begin(), in.end());
+            int r = fn->regs++;
+            auto& i = emit(IROp::SYSCALL, OpKind::UNKNOWN, in, exp->line);
+            i.defs.push_back(r);
+            i.resultUsed = ((SyscallExpr *)exp)->resultUsed;
+            stack.push_back(r);
+            return true;
+        }
+
+        case ASTKind::DUPEXPR:
+            if (stack.empty())
+                return false;
+            stack.push_back(stack.back());
+            return true;
+
+        case ASTKind::DROPEXPR:
+            return take(1, in);
+
+        case ASTKind::SWAPEXPR:
+            if (!take(2, in))
+                return false;
+            stack.insert(stack.end(), {in[1], in[0]});
+            return true;
+
+        case ASTKind::OVEREXPR:
+            if (stack.size() < 2)
+                return false;
+            stack.push_back(stack[stack.size()-2]);
+            return true;
+
+        case ASTKind::ROTEXPR:
+            if (!take(3, in))
+                return false;
+            stack.insert(stack.end(), {in[1], in[2], in[0]});
+            return true;
+
+        case ASTKind::PERMUTEEXPR:
+        {
+            auto p = (PermuteExpr *)exp;
+            if (!take(p->depth, in))
+                return false;
+            for (int i : p->order)
+                stack.push_back(in[i]);
+            return true;
+        }
+
+        case ASTKind::IFEXPR:
+            return lowerIf((IfExpr *)exp);
+
+        case ASTKind::WHILEEXPR:
+            return lowerWhile((WhileExpr *)exp);
+
+        case ASTKind::LETSTMT:
+        {
+            auto let = (LetExpr *)exp;
+            return take(let->idents.size(), in) && bind(let->idents, in, let->body);
+        }
+
+        case ASTKind::PEEKSTMT:
+        {
+            auto peek = (PeekExpr *)exp;
+            size_t n = peek->idents.size();
+            if (stack.size() < n)
+                return false;
+            in.assign(stack.end() - n, stack.end());
+            return bind(peek->idents, in, peek->body);
+        }
+
+        default:
+            return false;
+    }
+}
+
+bool Lowerer::lowerOp(OpExpr *op)
+{
+    std::vector<int> in;
+    switch (op->kind)
+    {
+        case OpKind::ADD:
+        case OpKind::SUB:
+        case OpKind::MUL:
+        case OpKind::LT:
+        case OpKind::GT:
+        case OpKind::LE:
+        case OpKind::GE:
+        case OpKind::EQ:
+        case OpKind::NE:
+        case OpKind::SHR:
+        case OpKind::SHL:
+        case OpKind::OR:
+        case OpKind::AND:
+            if (!take(2, in))
+                return false;
+            stack.push_back(value(IROp::BIN, op->kind, in, op->line));
+            return true;
+
+        case OpKind::DIVMOD:
+        {
+            if (!take(2, in))
+                return false;
+            auto& i = emit(IROp::DIVMOD, op->kind, in, op->line);
+            i.defs = {fn->regs, fn->regs + 1};
+            fn->regs += 2;
+            stack.insert(stack.end(), i.defs.begin(), i.defs.end());
+            return true;
+        }
+
+        case OpKind::NOT:
+            if (!take(1, in))
+                return false;
+            stack.push_back(value(IROp::NOT, op->kind, in, op->line));
+            return true;
+
+        case OpKind::LOAD8:
+        case OpKind::LOAD16:
+        case OpKind::LOAD32:
+        case OpKind::LOAD64:
+            if (!take(1, in))
+                return false;
+            stack.push_back(value(IROp::LOAD, op->kind, in, op->line));
+            return true;
+
+        case OpKind::STORE8:
+        case OpKind::STORE16:
+        case OpKind::STORE32:
+        case OpKind::STORE64:
+            // value below, ptr on top
+            if (!take(2, in))
+                return false;
+            emit(IROp::STORE, op->kind, in, op->line);
+            return true;
+
+        case OpKind::CASTBOOL:
+        case OpKind::CASTINT:
+        case OpKind::CASTPTR:
+            if (!take(1, in))
+                return false;
+            stack.push_back(value(IROp::CAST, op->kind, in, op->line));
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+bool Lowerer::lowerSuper(SuperExpr *s)
+{
+    std::vector<int> in;
+    size_t n = stack.size();
+    switch (s->kind)
+    {
+        case SuperKind::ADDIMM:
+        {
+            if (!take(1, in))
+                return false;
+            in.push_back(constant(Data(s->imm, TypeKind::INT), s->line));
+            stack.push_back(value(IROp::BIN, OpKind::ADD, in, s->line));
+            return true;
+        }
+
+        case SuperKind::DUPLOAD8:
+        case SuperKind::DUPLOAD64:
+            if (n < 1)
+                return false;
+            stack.push_back(value(IROp::LOAD, s->kind == SuperKind::DUPLOAD8 ? OpKind::LOAD8 : OpKind::LOAD64,
+                {stack[n-1]}, s->line));
+            return true;
+
+        case SuperKind::OVEROVERCMP:
+            if (n < 2)
+                return false;
+            stack.push_back(value(IROp::BIN, s->cmp, {stack[n-2], stack[n-1]}, s->line));
+            return true;
+
+        case SuperKind::SWAPSTORE8:
+        case SuperKind::SWAPSTORE64:
+            // ptr below, value on top
+            if (!take(2, in))
+                return false;
+            emit(IROp::STORE, s->kind == SuperKind::SWAPSTORE8 ? OpKind::STORE8 : OpKind::STORE64,
+                {in[1], in[0]}, s->line);
+            return true;
+    }
+    return false;
+}
+
+// A false condition runs else and then the if* chained after it, like the interpreter.
+bool Lowerer::lowerIf(IfExpr *f)
+{
+    IRInst term;
+    if (!test(f->cmp, false, f->line, term))
+        return false;
+    int thenB = newBlock();
+    int elseB = newBlock();
+    branch(term, thenB, elseB);
+
+    auto saved = stack;
+    cur = thenB;
+    if (!lower(f->then))
+        return false;
+    int thenEnd = cur;
+    auto thenStack = stack;
+
+    stack = saved;
+    cur = elseB;
+    if (!f->elze.empty())
+    {
+        if (!lower(f->elze))
+            return false;
+        if (f->next && !lowerIf(f->next))
+            return false;
+    }
+    return merge(thenEnd, thenStack);
+}
+
+// Every cell live at the loop gets a header phi; copy propagation removes the
+// ones the body leaves untouched. The block the loop starts in is its preheader.
+bool Lowerer::lowerWhile(WhileExpr *w)
+{
+    int pre = cur;
+    int header = newBlock();
+    jump(pre, header);
+    cur = header;
+    for (auto& r : stack)
+    {
+        IRInst phi;
+        phi.op = IROp::PHI;
+        phi.args = {r};
+        phi.defs = {fn->regs++};
+        fn->blocks[header].insts.push_back(phi);
+        r = phi.defs[0];
+    }
+    size_t depth = stack.size();
+
+    if (!lower(w->cond))
+        return false;
+    IRInst term;
+    if (!test(w->cmp, true, w->line, term))
+        return false;
+    int body = newBlock();
+    int exit = newBlock();
+    branch(term, body, exit);
+    auto after = stack;
+
+    cur = body;
+    if (!lower(w->body) || stack.size() != depth)
+        return false;
+    jump(cur, header);
+    for (size_t k = 0; k < depth; k++)
+        fn->blocks[header].insts[k].args.push_back(stack[k]);
+
+    stack = after;
+    cur = exit;
+    fn->loops.push_back(std::make_pair(pre, header));
+    return true;
+}
+
+// Procs lower only when their body never reaches below its params and ends
+// with exactly its results, so callers can treat a call as pop params, push results.
+// let/peek names are resolved lexically; a proc that reads a caller's binding
+// does not lower.
+static std::shared_ptr<IRFunc> lowerBody(ProcCmd *proc, const std::vector<Expr*>& body, int params, int results,
+    Env& env, const std::unordered_set<ProcCmd*>& callable, std::vector<Symbol> *baked = nullptr)
+{
+    auto fn = std::make_shared<IRFunc>();
+    fn->proc = proc;
+    fn->params = params;
+    fn->results = results;
+
+    Lowerer l(env, callable, fn.get());
+    l.baked = baked;
+    l.newBlock();
+    for (int k = 0; k < fn->params; k++)
+    {
+        int r = l.value(IROp::PARAM, OpKind::UNKNOWN, {}, proc->line);
+        fn->blocks[0].insts.back().imm = Data(k, TypeKind::INT);
+        l.stack.push_back(r);
+    }
+    if (!l.lower(body) || l.stack.size() != (size_t)fn->results)
+        return nullptr;
+    l.emit(IROp::RET, OpKind::UNKNOWN, l.stack, proc->line);
+    return fn;
+}
+
+static std::shared_ptr<IRFunc> lowerProc(ProcCmd *proc, Env& env, const std::unordered_set<ProcCmd*>& callable)
+{
+    return lowerBody(proc, proc->body, proc->sig.params.size(), proc->sig.retTypes.size(), env, callable);
+}
+
+// HELPERS
+
+static std::vector<int> successors(const IRBlock& b)
+{
+    auto& t = b.insts.back();
+    switch (t.op)
+    {
+        case IROp::JMP: return {t.target};
+        case IROp::BR:
+        case IROp::BRCMP: return {t.target, t.target2};
+        default: return {};
+    }
+}
+
+static int resolve(const std::vector<int>& repl, int r)
+{
+    while (repl[r] != r)
+        r = repl[r];
+    return r;
+}
+
+static void rename(IRFunc& fn, const std::vector<int>& repl)
+{
+    for (auto& b : fn.blocks)
+        for (auto& i : b.insts)
+            for (auto& a : i.args)
+                a = resolve(repl, a);
+}
+
+static void removePred(IRBlock& b, int pred)
+{
+    size_t k = std::find(b.preds.begin(), b.preds.end(), pred) - b.preds.begin();
+    b.preds.erase(b.preds.begin() + k);
+    for (auto& i : b.insts)
+        if (i.op == IROp::PHI)
+            i.args.erase(i.args.begin() + k);
+}
+
+static void postorder(const IRFunc& fn, int b, std::vector<bool>& seen, std::vector<int>& out)
+{
+    seen[b] = true;
+    for (int s : successors(fn.blocks[b]))
+        if (!seen[s])
+            postorder(fn, s, seen, out);
+    out.push_back(b);
+}
+
+// Immediate dominator of each block (Cooper, Harvey, Kennedy); -1 if unreachable.
+static std::vector<int> dominators(const IRFunc& fn)
+{
+    std::vector<bool> seen(fn.blocks.size());
+    std::vector<int> rpo;
+    postorder(fn, 0, seen, rpo);
+    std::reverse(rpo.begin(), rpo.end());
+    std::vector<int> order(fn.blocks.size(), -1);
+    for (size_t k = 0; k < rpo.size(); k++)
+        order[rpo[k]] = k;
+
+    std::vector<int> idom(fn.blocks.size(), -1);
+    idom[0] = 0;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t k = 1; k < rpo.size(); k++)
+        {
+            int b = rpo[k];
+            int d = -1;
+            for (int p : fn.blocks[b].preds)
+            {
+                if (idom[p] == -1)
+                    continue;
+                if (d == -1)
+                {
+                    d = p;
+                    continue;
+                }
+                int x = p;
+                while (x != d)
+                {
+                    while (order[x] > order[d])
+                        x = idom[x];
+                    while (order[d] > order[x])
+                        d = idom[d];
+                }
+            }
+            if (idom[b] != d)
+            {
+                idom[b] = d;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+// COPY PROPAGATION
+
+// The only copies left after lowering are phis whose inputs are all the same
+// register (or the phi itself): cells a loop or branch did not touch.
+static void propagateCopies(IRFunc& fn)
+{
+    std::vector<int> repl(fn.regs);
+    std::iota(repl.begin(), repl.end(), 0);
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto& b : fn.blocks)
+            for (size_t i = 0; i < b.insts.size() && b.insts[i].op == IROp::PHI;)
+            {
+                int def = b.insts[i].defs[0];
+                int same = -1;
+                bool copy = true;
+                for (int a : b.insts[i].args)
+                {
+                    a = resolve(repl, a);
+                    if (a == def || a == same)
+                        continue;
+                    if (same != -1)
+                    {
+                        copy = false;
+                        break;
+                    }
+                    same = a;
+                }
+                if (!copy || same == -1)
+                {
+                    i++;
+                    continue;
+                }
+                repl[def] = same;
+                b.insts.erase(b.insts.begin() + i);
+                changed = true;
+            }
+    }
+    rename(fn, repl);
+}
+
+// COMMON SUBEXPRESSION ELIMINATION
+
+static bool isPure(const IRInst& i)
+{
+    switch (i.op)
+    {
+        case IROp::CONST:
+        case IROp::BIN:
+        case IROp::DIVMOD:
+        case IROp::NOT:
+        case IROp::CAST:
+        case IROp::MAX:
+            return true;
+        default:
+            return false;
+    }
+}
+
+typedef std::tuple<int, int, std::vector<int>, long, int> ExprKey;
+
+static ExprKey exprKey(const IRInst& i)
+{
+    auto args = i.args;
+    switch (i.kind)
+    {
+        case OpKind::ADD:
+        case OpKind::MUL:
+        case OpKind::AND:
+        case OpKind::OR:
+        case OpKind::EQ:
+        case OpKind::NE:
+            std::sort(args.begin(), args.end());
+            break;
+        default:
+            if (i.op == IROp::MAX)
+                std::sort(args.begin(), args.end());
+            break;
+    }
+    return ExprKey((int)i.op, (int)i.kind, args, i.imm.getValue(), (int)i.imm.getType());
+}
+
+// Scoped value numbering over the dominator tree: a pure instruction is
+// replaced by an identical one that dominates it.
+static void numberValues(IRFunc& fn, int b, const std::vector<std::vector<int> >& children,
+    std::map<ExprKey, std::vector<int> >& avail, std::vector<int>& repl)
+{
+    std::vector<ExprKey> added;
+    auto& insts = fn.blocks[b].insts;
+    for (size_t i = 0; i < insts.size();)
+    {
+        for (auto& a : insts[i].args)
+            a = resolve(repl, a);
+        if (!isPure(insts[i]))
+        {
+            i++;
+            continue;
+        }
+        auto key = exprKey(insts[i]);
+        auto it = avail.find(key);
+        if (it == avail.end())
+        {
+            avail.insert(std::make_pair(key, insts[i].defs));
+            added.push_back(key);
+            i++;
+            continue;
+        }
+        for (size_t k = 0; k < it->second.size(); k++)
+            repl[insts[i].defs[k]] = it->second[k];
+        insts.erase(insts.begin() + i);
+    }
+    for (int c : children[b])
+        numberValues(fn, c, children, avail, repl);
+    for (auto& key : added)
+        avail.erase(key);
+}
+
+static void eliminateCommonSubexpressions(IRFunc& fn)
+{
+    auto idom = dominators(fn);
+    std::vector<std::vector<int> > children(fn.blocks.size());
+    for (size_t b = 1; b < fn.blocks.size(); b++)
+        if (idom[b] != -1)
+            children[idom[b]].push_back(b);
+
+    std::map<ExprKey, std::vector<int> > avail;
+    std::vector<int> repl(fn.regs);
+    std::iota(repl.begin(), repl.end(), 0);
+    numberValues(fn, 0, children, avail, repl);
+    rename(fn, repl);
+}
+
+// LOOP INVARIANT CODE MOTION
+
+// Hoisted code runs even when the loop body does not, so only ops that
+// cannot fault move (not divmod or loads).
+static bool isHoistable(const IRInst& i)
+{
+    return isPure(i) && i.op != IROp::DIVMOD;
+}
+
+static void hoistInvariants(IRFunc& fn)
+{
+    for (auto [pre, header] : fn.loops)
+    {
+        // natural loop: the header plus everything reaching a back edge without passing it
+        std::vector<bool> inLoop(fn.blocks.size());
+        inLoop[header] = true;
+        std::vector<int> work;
+        for (int p : fn.blocks[header].preds)
+            if (p != pre && !inLoop[p])
+            {
+                inLoop[p] = true;
+                work.push_back(p);
+            }
+        while (!work.empty())
+        {
+            int b = work.back();
+            work.pop_back();
+            for (int p : fn.blocks[b].preds)
+                if (!inLoop[p])
+                {
+                    inLoop[p] = true;
+                    work.push_back(p);
+                }
+        }
+
+        std::vector<int> defBlock(fn.regs, -1);
+        for (size_t b = 0; b < fn.blocks.size(); b++)
+            for (auto& i : fn.blocks[b].insts)
+                for (int d : i.defs)
+                    defBlock[d] = b;
+
+        auto& preInsts = fn.blocks[pre].insts;
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (size_t b = 0; b < fn.blocks.size(); b++)
+            {
+                if (!inLoop[b])
+                    continue;
+                auto& insts = fn.blocks[b].insts;
+                for (size_t i = 0; i < insts.size();)
+                {
+                    bool invariant = isHoistable(insts[i]) && std::all_of(insts[i].args.begin(), insts[i].args.end(),
+                        [&](int a) { return !inLoop[defBlock[a]]; });
+                    if (!invariant)
+                    {
+                        i++;
+                        continue;
+                    }
+                    defBlock[insts[i].defs[0]] = pre;
+                    preInsts.insert(preInsts.end() - 1, insts[i]);
+                    insts.erase(insts.begin() + i);
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+// DEAD CODE ELIMINATION
+
+// Roots: anything with an effect outside its registers, and ops that may fault.
+static bool isEffectful(const IRInst& i)
+{
+    switch (i.op)
+    {
+        case IROp::PARAM:
+        case IROp::CONST:
+        case IROp::PHI:
+        case IROp::BIN:
+        case IROp::NOT:
+        case IROp::CAST:
+        case IROp::MAX:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static void eliminateDeadCode(IRFunc& fn)
+{
+    std::vector<const IRInst*> def(fn.regs, nullptr);
+    std::vector<bool> live(fn.regs);
+    std::vector<int> work;
+    auto mark = [&](int r) {
+        if (!live[r])
+        {
+            live[r] = true;
+            work.push_back(r);
+        }
+    };
+
+    for (auto& b : fn.blocks)
+        for (auto& i : b.insts)
+        {
+            for (int d : i.defs)
+                def[d] = &i;
+            if (isEffectful(i))
+                for (int a : i.args)
+                    mark(a);
+        }
+    while (!work.empty())
+    {
+        int r = work.back();
+        work.pop_back();
+        for (int a : def[r]->args)
+            mark(a);
+    }
+
+    for (auto& b : fn.blocks)
+        b.insts.erase(std::remove_if(b.insts.begin(), b.insts.end(), [&](const IRInst& i) {
+            return !isEffectful(i) && std::none_of(i.defs.begin(), i.defs.end(), [&](int d) { return live[d]; });
+        }), b.insts.end());
+
+    // --io-uring may queue a write nobody reads the result of, here or in
+    // any caller (markDroppedSyscalls).
+    for (auto& b : fn.blocks)
+        for (auto& i : b.insts)
+            if (i.op == IROp::SYSCALL)
+                i.resultUsed = i.resultUsed && live[i.defs[0]];
+}
+
+// CONTROL FLOW CLEANUP
+
+// Drops unreachable blocks and renumbers the rest.
+static void compact(IRFunc& fn)
+{
+    std::vector<bool> seen(fn.blocks.size());
+    std::vector<int> order;
+    postorder(fn, 0, seen, order);
+
+    std::vector<int> index(fn.blocks.size(), -1);
+    std::vector<IRBlock> blocks;
+    for (size_t b = 0; b < fn.blocks.size(); b++)
+    {
+        if (!seen[b])
+            continue;
+        for (auto p : std::vector<int>(fn.blocks[b].preds))
+            if (!seen[p])
+                removePred(fn.blocks[b], p);
+        index[b] = blocks.size();
+        blocks.push_back(std::move(fn.blocks[b]));
+    }
+    for (auto& b : blocks)
+    {
+        for (auto& p : b.preds)
+            p = index[p];
+        auto& t = b.insts.back();
+        if (t.target != -1)
+            t.target = index[t.target];
+        if (t.target2 != -1)
+            t.target2 = index[t.target2];
+    }
+    fn.blocks = std::move(blocks);
+
+    std::vector<std::pair<int, int> > loops;
+    for (auto [pre, header] : fn.loops)
+        if (index[pre] != -1 && index[header] != -1)
+            loops.push_back(std::make_pair(index[pre], index[header]));
+    fn.loops = loops;
+}
+
+static bool isEmptyJump(const IRBlock& b)
+{
+    return b.insts.size() == 1 && b.insts[0].op == IROp::JMP;
+}
+
+static void retarget(IRInst& term, int from, int to)
+{
+    if (term.target == from)
+        term.target = to;
+    else if (term.target2 == from)
+        term.target2 = to;
+}
+
+// Branches whose arms were emptied by DCE (e.g. `if 100 drop end`), blocks
+// that only jump on, and straight-line chains split at old join points all
+// cost a dispatch each. Folds, threads and merges them.
+static void simplifyBranches(IRFunc& fn)
+{
+    // a branch whose two arms reach the same block with the same phi inputs is a jump
+    for (size_t p = 0; p < fn.blocks.size(); p++)
+    {
+        auto& term = fn.blocks[p].insts.back();
+        if ((term.op != IROp::BR && term.op != IROp::BRCMP) || term.expectBool)
+            continue;
+        int t = term.target, f = term.target2;
+        int viaT = isEmptyJump(fn.blocks[t]) ? t : p;
+        int viaF = isEmptyJump(fn.blocks[f]) ? f : p;
+        int joinT = viaT == (int)p ? t : fn.blocks[t].insts[0].target;
+        int joinF = viaF == (int)p ? f : fn.blocks[f].insts[0].target;
+        if (joinT != joinF || t == f || viaT == viaF)
+            continue;
+        auto& join = fn.blocks[joinT];
+        size_t kt = std::find(join.preds.begin(), join.preds.end(), viaT) - join.preds.begin();
+        size_t kf = std::find(join.preds.begin(), join.preds.end(), viaF) - join.preds.begin();
+        bool same = true;
+        for (auto& i : join.insts)
+            if (i.op == IROp::PHI && i.args[kt] != i.args[kf])
+                same = false;
+        if (!same)
+            continue;
+        IRInst jmp;
+        jmp.op = IROp::JMP;
+        jmp.target = t;
+        term = jmp;
+        removePred(fn.blocks[f], p);
+    }
+    compact(fn);
+
+    // preds of a block that only jumps on go straight to its target
+    for (size_t b = 1; b < fn.blocks.size(); b++)
+    {
+        if (!isEmptyJump(fn.blocks[b]))
+            continue;
+        int x = fn.blocks[b].insts[0].target;
+        if (x == (int)b)
+            continue;
+        for (int p : std::vector<int>(fn.blocks[b].preds))
+        {
+            auto& to = fn.blocks[x];
+            if (std::find(to.preds.begin(), to.preds.end(), p) != to.preds.end())
+                continue;
+            size_t k = std::find(to.preds.begin(), to.preds.end(), (int)b) - to.preds.begin();
+            to.preds.push_back(p);
+            for (auto& i : to.insts)
+                if (i.op == IROp::PHI)
+                    i.args.push_back(i.args[k]);
+            retarget(fn.blocks[p].insts.back(), b, x);
+            removePred(fn.blocks[b], p);
+        }
+    }
+    compact(fn);
+
+    // a block that is its only pred's only successor joins that pred
+    for (size_t p = 0; p < fn.blocks.size(); p++)
+    {
+        while (true)
+        {
+            auto& term = fn.blocks[p].insts.back();
+            if (term.op != IROp::JMP)
+                break;
+            int x = term.target;
+            auto& next = fn.blocks[x];
+            if (x == (int)p || x == 0 || next.preds.size() != 1 || next.insts[0].op == IROp::PHI)
+                break;
+            auto& insts = fn.blocks[p].insts;
+            insts.pop_back();
+            insts.insert(insts.end(), next.insts.begin(), next.insts.end());
+            for (int s : successors(next))
+                std::replace(fn.blocks[s].preds.begin(), fn.blocks[s].preds.end(), x, (int)p);
+            next.preds.clear();
+            next.insts = {insts.back()};    // unreachable; keeps a terminator for compact
+        }
+    }
+    compact(fn);
+    // a folded branch no longer uses its condition
+    eliminateDeadCode(fn);
+}
+
+// TAIL CALLS
+
+static bool isReturnBlock(const IRBlock& b)
+{
+    for (size_t i = 0; i + 1 < b.insts.size(); i++)
+        if (b.insts[i].op != IROp::PHI)
+            return false;
+    return b.insts.back().op == IROp::RET;
+}
+
+// Copies the ret of a join block into each predecessor that jumps to it,
+// so a call at the end of a branch is directly followed by its ret and can
+// become a TAILCALL.
+static void formTailCalls(IRFunc& fn)
+{
+    for (size_t b = 0; b < fn.blocks.size(); b++)
+    {
+        int r = fn.blocks[b].insts.back().target;
+        if (fn.blocks[b].insts.back().op != IROp::JMP || r == (int)b || !isReturnBlock(fn.blocks[r]))
+            continue;
+        auto& ret = fn.blocks[r];
+        size_t k = std::find(ret.preds.begin(), ret.preds.end(), (int)b) - ret.preds.begin();
+        IRInst dup = ret.insts.back();
+        for (auto& a : dup.args)
+            for (auto& phi : ret.insts)
+                if (phi.op == IROp::PHI && phi.defs[0] == a)
+                {
+                    a = phi.args[k];
+                    break;
+                }
+        removePred(ret, b);
+        fn.blocks[b].insts.back() = dup;
+    }
+    compact(fn);
+
+    for (auto& b : fn.blocks)
+    {
+        auto& insts = b.insts;
+        if (insts.size() < 2)
+            continue;
+        auto& call = insts[insts.size()-2];
+        if (call.op == IROp::CALL && insts.back().op == IROp::RET && call.defs == insts.back().args)
+        {
+            call.op = IROp::TAILCALL;
+            call.defs.clear();
+            insts.pop_back();
+        }
+    }
+}
+
+// DRIVER
+
+static void runPipeline(IRFunc& fn, std::ostream *dump)
+{
+    if (dump)
+        dumpIR(*dump, fn, "lowering");
+    propagateCopies(fn);
+    if (dump)
+        dumpIR(*dump, fn, "copy propagation");
+    eliminateCommonSubexpressions(fn);
+    if (dump)
+        dumpIR(*dump, fn, "cse");
+    hoistInvariants(fn);
+    if (dump)
+        dumpIR(*dump, fn, "licm");
+    eliminateDeadCode(fn);
+    if (dump)
+        dumpIR(*dump, fn, "dce");
+    simplifyBranches(fn);
+    if (dump)
+        dumpIR(*dump, fn, "branches");
+    formTailCalls(fn);
+    if (dump)
+        dumpIR(*dump, fn, "tail calls");
+
+    fn.paramRegs.assign(fn.params, -1);
+    for (auto& i : fn.blocks[0].insts)
+        if (i.op == IROp::PARAM)
+            fn.paramRegs[i.imm.getValue()] = i.defs[0];
+}
+
+// Procs that already have IR are callable as they are; the rest of procs
+// lower together.
+static void lowerSet(Env& env, const std::map<std::string, ProcCmd*>& procs, std::ostream *dump, bool install)
+{
+    // A call lowers only if its callee does, so shrink the callable set
+    // until every member lowers against it.
+    std::unordered_set<ProcCmd*> callable;
+    for (auto& [name, proc] : env.procs)
+        if (proc->ir)
+            callable.insert(proc);
+    for (auto& [name, proc] : procs)
+        callable.insert(proc);
+    std::map<std::string, std::shared_ptr<IRFunc> > lowered;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        lowered.clear();
+        for (auto& [name, proc] : procs)
+        {
+            if (!callable.count(proc))
+                continue;
+            if (auto fn = lowerProc(proc, env, callable))
+                lowered[name] = fn;
+            else
+            {
+                callable.erase(proc);
+                changed = true;
+            }
+        }
+    }
+
+    for (auto& [name, proc] : procs)
+    {
+        auto it = lowered.find(name);
+        if (it == lowered.end())
+        {
+            if (dump)
+                *dump << "; " << name << ": not lowered\n";
+            if (install)
+                proc->tierFailed = true;
+            continue;
+        }
+        runPipeline(*it->second, dump);
+        if (install)
+            proc->ir = it->second;
+    }
+}
+
+void lowerProcs(Env& env, std::ostream *dump, bool install)
+{
+    std::map<std::string, ProcCmd*> procs;
+    for (auto& [name, proc] : env.procs)
+        if (proc->parsed)
+            procs[proc->name] = proc;
+    lowerSet(env, procs, dump, install);
+}
+
+// Parsed procs without IR that body can reach through plain calls.
+static void collectCallees(std::vector<Expr*>& body, Env& env, std::map<std::string, ProcCmd*>& out)
+{
+    walkBodies(body, [&](std::vector<Expr*>& list, std::vector<Symbol>&) {
+        for (auto e : list)
+        {
+            if (e->getASTKind() != ASTKind::VAREXPR)
+                continue;
+            auto it = env.procs.find(((VarExpr *)e)->sym);
+            if (it == env.procs.end())
+                continue;
+            auto proc = it->second;
+            if (proc->ir || !proc->parsed || proc->tierFailed || out.count(proc->name))
+                continue;
+            out[proc->name] = proc;
+            collectCallees(proc->body, env, out);
+        }
+    });
+}
+
+bool tierUp(ProcCmd *proc, Env& env, std::ostream *dump)
+{
+    if (!proc->parsed)
+        return false;
+    std::map<std::string, ProcCmd*> procs;
+    procs[proc->name] = proc;
+    collectCallees(proc->body, env, procs);
+    lowerSet(env, procs, dump, true);
+    return proc->ir != nullptr;
+}
+
+std::shared_ptr<IRFunc> lowerLoop(WhileExpr *w, ProcCmd *owner, Env& env, int depth, std::ostream *dump,
+    std::vector<Symbol> *baked)
+{
+    std::vector<Expr*> body{w};
+    std::map<std::string, ProcCmd*> procs;
+    collectCallees(body, env, procs);
+    if (!procs.empty())
+        lowerSet(env, procs, dump, true);
+
+    std::unordered_set<ProcCmd*> callable;
+    for (auto& [name, proc] : env.procs)
+        if (proc->ir)
+            callable.insert(proc);
+    auto fn = lowerBody(owner, body, depth, depth, env, callable, baked);
+    if (fn)
+        runPipeline(*fn, dump);
+    return fn;
+}
+
+// DUMP
+
+static std::string regList(const std::vector<int>& regs)
+{
+    std::string s;
+    for (int r : regs)
+        s += " r" + std::to_string(r);
+    return s;
+}
+
+static std::string typeSuffix(TypeKind t)
+{
+    switch (t)
+    {
+        case TypeKind::BOOL: return ":bool";
+        case TypeKind::PTR: return ":ptr";
+        case TypeKind::ADDR: return ":addr";
+        default: return "";
+    }
+}
+
+static std::string instString(const IRInst& i)
+{
+    std::string s;
+    if (!i.defs.empty())
+        s = regList(i.defs).substr(1) + " = ";
+    auto target = [](int b) { return " b" + std::to_string(b); };
+    switch (i.op)
+    {
+        case IROp::PARAM: return s + "param " + std::to_string(i.imm.getValue());
+        case IROp::CONST: return s + "const " + std::to_string(i.imm.getValue()) + typeSuffix(i.imm.getType());
+        case IROp::PHI: return s + "phi" + regList(i.args);
+        case IROp::BIN: return s + opName(i.kind) + regList(i.args);
+        case IROp::DIVMOD: return s + "divmod" + regList(i.args);
+        case IROp::NOT: return s + "not" + regList(i.args);
+        case IROp::CAST: return s + opName(i.kind) + regList(i.args);
+        case IROp::MAX: return s + "max" + regList(i.args);
+        case IROp::LOAD: return s + opName(i.kind) + regList(i.args);
+        case IROp::STORE: return opName(i.kind) + regList(i.args);
+        case IROp::CALL: return s + "call " + i.callee->name + regList(i.args);
+        case IROp::NATIVE: return s + "native " + i.callee->name + regList(i.args);
+        case IROp::SYSCALL: return s + "syscall" + std::to_string(i.args.size()-1) + regList(i.args);
+        case IROp::PRINT: return "print" + regList(i.args);
+        case IROp::JMP: return "jmp" + target(i.target);
+        case IROp::BR: return "br" + regList(i.args) + target(i.target) + target(i.target2);
+        case IROp::BRCMP: return "br " + opName(i.kind) + regList(i.args) + target(i.target) + target(i.target2);
+        case IROp::RET: return "ret" + regList(i.args);
+        case IROp::TAILCALL: return "tailcall " + i.callee->name + regList(i.args);
+    }
+    return s + "?";
+}
+
+void dumpIR(std::ostream& out, const IRFunc& fn, const std::string& stage)
+{
+    out << "; " << fn.proc->name << " after " << stage << "\n";
+    out << "proc " << fn.proc->name << " (" << fn.params << " -> " << fn.results << ")\n";
+    for (size_t b = 0; b < fn.blocks.size(); b++)
+    {
+        out << "  b" << b << ":";
+        if (!fn.blocks[b].preds.empty())
+        {
+            out << "  ; preds";
+            for (int p : fn.blocks[b].preds)
+                out << " b" << p;
+        }
+        out << "\n";
+        for (auto& i : fn.blocks[b].insts)
+            out << "    " << instString(i) << "\n";
+    }
+    out << std::endl;
+}
+
+// EXECUTION
+
+class IRFrame
+{
+public:
+    IRFunc *fn;
+    size_t base;        // first register of this call in the shared register file
+    int block;
+    size_t inst;        // the CALL being executed, while a callee runs
+};
+
+static Data binary(OpKind kind, long a, long b)
+{
+    switch (kind)
+    {
+        case OpKind::ADD: return Data(a + b, TypeKind::INT);
+        case OpKind::SUB: return Data(a - b, TypeKind::INT);
+        case OpKind::MUL: return Data(a * b, TypeKind::INT);
+        case OpKind::SHR: return Data(a >> b, TypeKind::INT);
+        case OpKind::SHL: return Data(a << b, TypeKind::INT);
+        case OpKind::OR: return Data(a | b, TypeKind::INT);
+        case OpKind::AND: return Data(a & b, TypeKind::INT);
+        default: return Data(compare(kind, a, b), TypeKind::BOOL);
+    }
+}
+
+static long load(OpKind kind, long ptr)
+{
+    switch (kind)
+    {
+        case OpKind::LOAD8: return *((unsigned char *)ptr);
+        case OpKind::LOAD16: return *((unsigned short *)ptr);
+        case OpKind::LOAD32: return *((unsigned int *)ptr);
+        default: return *((unsigned long *)ptr);
+    }
+}
+
+// Bytes touched by a LOAD or STORE of kind, for --check-memory.
+static int accessWidth(OpKind kind)
+{
+    switch (kind)
+    {
+        case OpKind::LOAD8: case OpKind::STORE8: return 1;
+        case OpKind::LOAD16: case OpKind::STORE16: return 2;
+        case OpKind::LOAD32: case OpKind::STORE32: return 4;
+        default: return 8;
+    }
+}
+
+static void store(OpKind kind, long ptr, long val)
+{
+    switch (kind)
+    {
+        case OpKind::STORE8: *((unsigned char *)ptr) = val & 0xFF; break;
+        case OpKind::STORE16: *((unsigned short *)ptr) = val & 0xFFFF; break;
+        case OpKind::STORE32: *((unsigned int *)ptr) = val & 0xFFFFFFFF; break;
+        default: *((unsigned long *)ptr) = val; break;
+    }
+}
+
+static Data cast(OpKind kind, Data d)
+{
+    switch (kind)
+    {
+        case OpKind::CASTBOOL: return Data(d.getValue() > 0, TypeKind::BOOL);
+        case OpKind::CASTINT: return Data(d.getValue(), TypeKind::INT);
+        default: return Data(d.getValue(), TypeKind::PTR);
+    }
+}
+
+// Makes room for fn's registers at base and moves its params in from args.
+static Data *enterIR(IRFunc *fn, std::vector<Data>& regs, size_t base, const std::vector<Data>& args)
+{
+    if (regs.size() < base + fn->regs)
+        regs.resize(base + fn->regs);
+    Data *r = regs.data() + base;
+    for (int k = 0; k < fn->params; k++)
+        if (fn->paramRegs[k] >= 0)
+            r[fn->paramRegs[k]] = args[k];
+    return r;
+}
+
+// Calls push a frame instead of recursing, so Porth recursion depth does not
+// use native stack. Only the entry proc's params and results go through the
+// Porth stack; calls between IR procs pass registers directly.
+void runIR(IRFunc *entry, Stack& stack)
+{
+    std::vector<Data> regs;
+    std::vector<IRFrame> frames;
+    std::vector<Data> incoming;
+    std::vector<long> sysargs;
+    Stack nativeStack;
+    // The caller brackets the entry; calls made here are bracketed below.
+    bool tracing = tracingCalls();
+
+    stack.assertMinSize(entry->params, entry->proc->line);
+    incoming.resize(entry->params);
+    for (int k = entry->params-1; k >= 0; k--)
+        incoming[k] = stack.pop();
+
+    IRFunc *fn = entry;
+    size_t base = 0;
+    int b = 0;
+    Data *R = enterIR(fn, regs, base, incoming);
+    const IRInst *ip = fn->blocks[0].insts.data();
+    frames.push_back(IRFrame{fn, base, 0, 0});
+
+    // Enters block `to` from b, copying its phi inputs in parallel.
+    auto jump = [&](int to) {
+        auto& block = fn->blocks[to];
+        ip = block.insts.data();
+        if (ip->op == IROp::PHI)
+        {
+            size_t k = std::find(block.preds.begin(), block.preds.end(), b) - block.preds.begin();
+            incoming.clear();
+            for (auto p = ip; p->op == IROp::PHI; p++)
+                incoming.push_back(R[p->args[k]]);
+            for (auto& v : incoming)
+                R[(ip++)->defs[0]] = v;
+        }
+        b = to;
+    };
+
+    // Collects a call's or ret's operands before the registers they live in are reused.
+    auto gather = [&](const std::vector<int>& args) {
+        incoming.clear();
+        for (int a : args)
+            incoming.push_back(R[a]);
+    };
+
+    while (true)
+    {
+        const IRInst& in = *ip++;
+        if (options.sampleHz && in.line)
+            noteSampleLine(in.line);
+        switch (in.op)
+        {
+            case IROp::PARAM:
+            case IROp::PHI:
+                break;
+
+            case IROp::CONST:
+                R[in.defs[0]] = in.imm;
+                break;
+
+            case IROp::BIN:
+                R[in.defs[0]] = binary(in.kind, R[in.args[0]].getValue(), R[in.args[1]].getValue());
+                break;
+
+            case IROp::DIVMOD:
+            {
+                long lhs = R[in.args[0]].getValue();
+                long rhs = R[in.args[1]].getValue();
+                R[in.defs[0]] = Data(lhs / rhs, TypeKind::INT);
+                R[in.defs[1]] = Data(lhs % rhs, TypeKind::INT);
+                break;
+            }
+
+            case IROp::NOT:
+                R[in.defs[0]] = Data(~R[in.args[0]].getValue(), TypeKind::INT);
+                break;
+
+            case IROp::CAST:
+                R[in.defs[0]] = cast(in.kind, R[in.args[0]]);
+                break;
+
+            case IROp::MAX:
+                R[in.defs[0]] = Data(std::max(R[in.args[0]].getValue(), R[in.args[1]].getValue()), TypeKind::INT);
+                break;
+
+            case IROp::LOAD:
+                if (options.checkMemory)
+                    checkAccess(R[in.args[0]].getValue(), accessWidth(in.kind), false, in.line);
+                R[in.defs[0]] = Data(load(in.kind, R[in.args[0]].getValue()), TypeKind::INT);
+                break;
+
+            case IROp::STORE:
+                if (options.checkMemory)
+                    checkAccess(R[in.args[1]].getValue(), accessWidth(in.kind), true, in.line);
+                store(in.kind, R[in.args[1]].getValue(), R[in.args[0]].getValue());
+                break;
+
+            case IROp::SYSCALL:
+            {
+                int sysnum = R[in.args[0]].getValue() & 0xFFFFFF;
+                sysargs.clear();
+                for (size_t k = 1; k < in.args.size(); k++)
+                    sysargs.push_back(R[in.args[k]].getValue());
+                R[in.defs[0]] = Data(syscall(sysnum, sysargs, in.resultUsed), TypeKind::INT);
+                break;
+            }
+
+            case IROp::PRINT:
+                syncSyscalls();
+                std::cout << R[in.args[0]].getValue() << std::endl;
+                break;
+
+            case IROp::JMP:
+                jump(in.target);
+                break;
+
+            case IROp::BR:
+            {
+                Data c = R[in.args[0]];
+                if (in.expectBool && !c.isTrue() && !c.isFalse())
+                {
+                    std::cout << "Error:" << in.line << ": Expected bool, got " << Type(c.getType()).toString() << std::endl;
+                    throw new std::exception();
+                }
+                jump(c.isTrue() ? in.target : in.target2);
+                break;
+            }
+
+            case IROp::BRCMP:
+                jump(compare(in.kind, R[in.args[0]].getValue(), R[in.args[1]].getValue()) ? in.target : in.target2);
+                break;
+
+            case IROp::CALL:
+                gather(in.args);
+                frames.back().block = b;
+                frames.back().inst = &in - fn->blocks[b].insts.data();
+                base += fn->regs;
+                fn = in.callee->ir.get();
+                if (tracing)
+                    profileEnter(in.callee);
+                R = enterIR(fn, regs, base, incoming);
+                frames.push_back(IRFrame{fn, base, 0, 0});
+                b = 0;
+                ip = fn->blocks[0].insts.data();
+                break;
+
+            case IROp::NATIVE:
+                nativeStack.clear();
+                for (int a : in.args)
+                    nativeStack.push(R[a]);
+                if (tracing)
+                    profileEnter(in.callee);
+                if (in.callee->native)
+                    in.callee->native(nativeStack);
+                else
+                    in.callee->thunk(nativeStack, in.callee->symbol);
+                if (tracing)
+                    profileExit();
+                for (int k = in.defs.size()-1; k >= 0; k--)
+                    R[in.defs[k]] = nativeStack.pop();
+                break;
+
+            case IROp::TAILCALL:
+                gather(in.args);
+                fn = in.callee->ir.get();
+                if (tracing)
+                    profileTailCall(in.callee);
+                R = enterIR(fn, regs, base, incoming);
+                frames.back().fn = fn;
+                b = 0;
+                ip = fn->blocks[0].insts.data();
+                break;
+
+            case IROp::RET:
+            {
+                gather(in.args);
+                frames.pop_back();
+                if (frames.empty())
+                {
+                    for (auto& v : incoming)
+                        stack.push(v);
+                    return;
+                }
+                if (tracing)
+                    profileExit();
+                auto& f = frames.back();
+                fn = f.fn;
+                base = f.base;
+                b = f.block;
+                R = regs.data() + base;
+                ip = fn->blocks[b].insts.data() + f.inst;
+                auto& call = *ip++;
+                for (size_t k = 0; k < call.defs.size(); k++)
+                    R[call.defs[k]] = incoming[k];
+                break;
+            }
+        }
+    }
+}
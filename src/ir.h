@@ -0,0 +1,89 @@
+#ifndef CPPORTH_IR_H
+#define CPPORTH_IR_H
+
+#include <ostream>
+#include "runtime.h"
+
+// Register-based SSA form of a proc body. Every value is a register that is
+// written by exactly one instruction; stack words only rename registers.
+enum class IROp
+{
+    PARAM,      // defs[0] = parameter imm (0 is the deepest)
+    CONST,      // defs[0] = imm
+    PHI,        // defs[0] = args[i] when entered from preds[i]
+    BIN,        // defs[0] = args[0] <kind> args[1]
+    DIVMOD,     // defs = {args[0] / args[1], args[0] % args[1]}
+    NOT,
+    CAST,       // kind is CASTBOOL, CASTINT or CASTPTR
+    MAX,
+    LOAD,       // kind is LOAD8..LOAD64
+    STORE,      // kind is STORE8..STORE64; args = {value, ptr}
+    CALL,       // args are the callee's params, defs its results
+    NATIVE,     // CALL of a proc with a native builtin or an extern (callee->native or ->thunk)
+    SYSCALL,    // args = {number, arg0, arg1, ...}
+    PRINT,
+    JMP,        // to target
+    BR,         // to target if args[0] is true, else target2
+    BRCMP,      // to target if args[0] <kind> args[1], else target2
+    RET,        // args are the proc's results
+    TAILCALL    // CALL whose results are returned as they are
+};
+
+class IRInst
+{
+public:
+    IROp op;
+    OpKind kind = OpKind::UNKNOWN;
+    std::vector<int> args;
+    std::vector<int> defs;
+    Data imm;
+    int target = -1;
+    int target2 = -1;
+    bool expectBool = false;    // BR of a while condition: non-bools are an error
+    bool resultUsed = true;     // SYSCALL: false when nothing reads defs[0]
+    ProcCmd *callee = nullptr;
+    int line = 0;
+};
+
+class IRBlock
+{
+public:
+    std::vector<int> preds;
+    std::vector<IRInst> insts;  // PHIs first, exactly one terminator last
+};
+
+class IRFunc
+{
+public:
+    ProcCmd *proc;
+    int params;
+    int results;
+    int regs = 0;
+    std::vector<IRBlock> blocks;                // blocks[0] is the entry
+    std::vector<std::pair<int, int> > loops;    // (preheader, header), inner loops first
+    std::vector<int> paramRegs;                 // register of each PARAM, -1 if unused
+};
+
+// Lowers every parsed proc that stays within the supported subset and whose
+// body provably matches its signature, then runs the IR pipeline
+// (copy propagation, CSE, LICM, DCE, tail calls) on it. Each stage is printed
+// to dump when it is non-null. Lowered procs get ProcCmd::ir when install is set.
+void lowerProcs(Env&, std::ostream *dump, bool install);
+
+// --tiered: lowers proc together with the procs it calls that have no IR
+// yet, and installs whatever lowers. Returns true if proc now has IR.
+bool tierUp(ProcCmd *, Env&, std::ostream *dump);
+
+// --tiered on-stack replacement: lowers a while loop of owner as a function
+// of the top depth cells, which it leaves in place. let/peek names in env
+// are baked in as constants, so the result is only valid in that scope;
+// the names of all env variables it bakes in are added to baked.
+std::shared_ptr<IRFunc> lowerLoop(WhileExpr *, ProcCmd *owner, Env&, int depth, std::ostream *dump,
+    std::vector<Symbol> *baked = nullptr);
+
+void dumpIR(std::ostream&, const IRFunc&, const std::string&);
+
+// Pops the proc's params from stack, runs it and pushes its results.
+void runIR(IRFunc *, Stack&);
+
+#endif // CPPORTH_IR_H
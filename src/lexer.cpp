@@ -1,4 +1,5 @@
 #include "lexer.h"
+#include "profiler.h"
 #include <format>
 #include <algorithm>
 
@@ -23,6 +24,7 @@ Lexer::Lexer(std::string input) : input(input), line(1), index(0) {;}
 
 std::vector<Token> Lexer::lex()
 {
+    TraceScope trace("Lexer::lex");
     std::vector<Token> tokens;
     
     while (index < input.length())
@@ -365,6 +367,16 @@ Token Lexer::lexKeyword()
         tt = TokenType::FREE;
     else if (acc == "new") // Porth++
         tt = TokenType::NEW;
+    else if (acc == "memchr") // Porth++
+        tt = TokenType::MEMCHR;
+    else if (acc == "memcmp") // Porth++
+        tt = TokenType::MEMCMP;
+    else if (acc == "find-byte-set") // Porth++
+        tt = TokenType::FINDBYTESET;
+    else if (acc == "count-byte") // Porth++
+        tt = TokenType::COUNTBYTE;
+    else if (acc == "extern") // Porth++
+        tt = TokenType::EXTERN;
     else if (acc == "cast(int)" || acc == "cast(bool)" || acc == "cast(ptr)" 
         || acc == "and" || acc == "or" || acc == "not" || acc == "shr" || acc == "shl" 
         || acc == "idivmod" || acc == "divmod")
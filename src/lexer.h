@@ -59,7 +59,12 @@ enum class TokenType
     ALLOC,
     FREE, // 48
     COLON,
-    NEW
+    NEW,
+    MEMCHR,
+    MEMCMP,
+    FINDBYTESET,
+    COUNTBYTE,
+    EXTERN
 };
 
 class Token
@@ -6,6 +6,9 @@
 #include "parser.h"
 #include "runtime.h"
 #include "args.h"
+#include "syscalls.h"
+#include "codegen.h"
+#include "profiler.h"
 //#include "typechecker.h"
 
 int main(int argc, char **argv)
@@ -17,6 +20,12 @@ int main(int argc, char **argv)
     }
     
     Args args(argc, argv);
+    if (options.ioUring && !enableIoUring())
+        std::cerr << "Warning: io_uring unavailable, using plain syscalls." << std::endl;
+
+    if (options.sampleHz)
+        startSampling(options.sampleHz);
+
     auto txt = openFile(args.filepath);
 
     Lexer lexer(txt);
@@ -25,7 +34,7 @@ int main(int argc, char **argv)
         //for (auto t : tokens)
         //    std::cout << t.toString() << std::endl;
 
-    Parser parser(tokens);
+    Parser parser(tokens, options.lazyProcs);
     std::vector<AST*> asts = parser.parse();
         //for (AST *ast : asts)
         //    std::cout << ast->toString() << std::endl;
@@ -39,9 +48,42 @@ int main(int argc, char **argv)
     // TypeStack tstack;
     // typecheck(asts, tstack, tenv);
     
+    if (args.command == "compile")
+    {
+        // argc and argv are read from the process stack, so they are not
+        // bound (and folded) at compile time.
+        Env e;
+        e.filepath = args.filepath;
+        load(asts, e);
+        auto base = args.filepath;
+        if (base.size() > 6 && base.substr(base.size()-6) == ".porth")
+            base = base.substr(0, base.size()-6);
+        bool ok = compileAsm(e, base);
+        parser.cleanup(asts);
+        return ok ? 0 : 1;
+    }
+
     Stack s;
     Env e(args.porthArgs.size(), pargs);
     interp(asts, s, e);
+    syncSyscalls();
+    if (options.ngrams)
+        dumpNgrams(std::cerr, 20);
+    if (options.opStats)
+        dumpOpStats(std::cerr, 20);
+    if (options.profile)
+        dumpProfile(std::cerr, 3);
+    if (options.heapProfile)
+        dumpHeapProfile(std::cerr);
+    if (!options.trace.empty() && !writeTrace(options.trace))
+        std::cerr << "Could not open file " << options.trace << std::endl;
+    if (options.sampleHz && options.sampleOut.empty())
+        dumpSamples(std::cerr);
+    else if (options.sampleHz)
+    {
+        std::ofstream out(options.sampleOut);
+        dumpSamples(out);
+    }
 
     parser.cleanup(asts);
 
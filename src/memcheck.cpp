@@ -0,0 +1,81 @@
+#include "memcheck.h"
+#include <iostream>
+#include <map>
+#include <exception>
+#include <algorithm>
+#include <string>
+
+class Region
+{
+public:
+    long end;
+    const char *kind;
+    int line;
+};
+
+// Live regions by start address. Regions never overlap, so the only
+// candidate for an address is the last region starting at or before it.
+static std::map<long, Region>& regions()
+{
+    static std::map<long, Region> r;
+    return r;
+}
+
+long checkedStart = 0, checkedEnd = 0;
+
+
+void trackRegion(const void *p, long size, const char *kind, int line)
+{
+    regions()[(long)p] = Region{(long)p + size, kind, line};
+}
+
+void untrackRegion(const void *p)
+{
+    if ((long)p == checkedStart)
+        checkedStart = checkedEnd = 0;
+    regions().erase((long)p);
+}
+
+static void check(long addr, long width, const std::string& word, int line)
+{
+    auto& rs = regions();
+    auto it = rs.upper_bound(addr);
+    bool below = it != rs.begin();
+    if (below)
+    {
+        --it;
+        if (addr + width <= it->second.end)
+        {
+            checkedStart = it->first;
+            checkedEnd = it->second.end;
+            return;
+        }
+    }
+
+    std::cout << "Error:" << line << ": " << word << " at 0x" << std::hex << addr << std::dec;
+    // Addresses less than a region's length past its end are reported
+    // against it; anything further is more likely a stray pointer.
+    long size = below ? it->second.end - it->first : 0;
+    if (below && addr - it->second.end < std::max(size, 8L))
+    {
+        std::cout << " is " << addr + width - it->second.end << " byte(s) past the end of the "
+                  << size << "-byte " << it->second.kind << " region";
+        if (it->second.line > 0)
+            std::cout << " from line " << it->second.line;
+        std::cout << "." << std::endl;
+    }
+    else
+        std::cout << " does not point into any live region." << std::endl;
+    throw new std::exception();
+}
+
+void checkAccessSlow(long addr, int width, bool store, int line)
+{
+    check(addr, width, (store ? "!" : "@") + std::to_string(width * 8), line);
+}
+
+void checkSpan(long addr, long n, const char *word, int line)
+{
+    if (n > 0 && (addr < checkedStart || addr + n > checkedEnd))
+        check(addr, n, word, line);
+}
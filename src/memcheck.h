@@ -0,0 +1,27 @@
+#ifndef CPPORTH_MEMCHECK_H
+#define CPPORTH_MEMCHECK_H
+
+// --check-memory: every region the runtime hands out (alloc, global and
+// local memory, variants, string literals, here, argv) is kept in an interval
+// index, and @8..@64 and !8..!64 check their address against it first.
+void trackRegion(const void *, long size, const char *kind, int line);
+void untrackRegion(const void *);
+
+// The region of the last access that passed, so runs of accesses to the same
+// buffer skip the index.
+extern long checkedStart, checkedEnd;
+void checkAccessSlow(long addr, int width, bool store, int line);
+
+// Like checkAccess for the n bytes a builtin such as memchr reads; word names
+// it in the error. Empty spans always pass.
+void checkSpan(long addr, long n, const char *word, int line);
+
+// Prints an error with the Porth line and throws if [addr, addr + width) is
+// not inside one live region.
+inline void checkAccess(long addr, int width, bool store, int line)
+{
+    if (addr < checkedStart || addr + width > checkedEnd)
+        checkAccessSlow(addr, width, store, line);
+}
+
+#endif // CPPORTH_MEMCHECK_H
@@ -0,0 +1,236 @@
+#include "native.h"
+#include "runtime.h"
+#include "syscalls.h"
+#include "args.h"
+#include <dlfcn.h>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <utility>
+
+// The copies, fills and scans below go through glibc, which picks its
+// SSE2/AVX2 (or ERMS) implementation for the CPU at load time.
+
+// Str from std.porth: count at offset 0, data at offset 8.
+class Str
+{
+public:
+    long count;
+    char *data;
+};
+
+// memcpy int ptr ptr -- ptr: size src dst -- dst. The Porth loop copies
+// forwards one byte at a time, so a dst just above an overlapping src
+// repeats the first bytes; that case keeps the byte loop.
+static void nativeMemcpy(Stack& stack)
+{
+    auto dst = (unsigned char *)stack.pop().getValue();
+    auto src = (unsigned char *)stack.pop().getValue();
+    long size = stack.pop().getValue();
+    if (size > 0)
+    {
+        if (dst > src && dst < src + size)
+            for (long i = 0; i < size; i++)
+                dst[i] = src[i];
+        else
+            std::memmove(dst, src, size);
+    }
+    stack.push(Data((long)dst, TypeKind::PTR));
+}
+
+// memset int int ptr -- ptr: size byte data -- data
+static void nativeMemset(Stack& stack)
+{
+    auto data = (unsigned char *)stack.pop().getValue();
+    long byte = stack.pop().getValue();
+    long size = stack.pop().getValue();
+    if (size > 0)
+        std::memset(data, byte & 0xFF, size);
+    stack.push(Data((long)data, TypeKind::PTR));
+}
+
+// cstrlen ptr -- int
+static void nativeCstrlen(Stack& stack)
+{
+    auto s = (const char *)stack.pop().getValue();
+    stack.push((long)std::strlen(s));
+}
+
+// cstreq ptr ptr -- bool
+static void nativeCstreq(Stack& stack)
+{
+    auto b = (const char *)stack.pop().getValue();
+    auto a = (const char *)stack.pop().getValue();
+    stack.push(std::strcmp(a, b) == 0);
+}
+
+// streq int ptr int ptr -- bool: n1 s1 n2 s2 -- equal
+static void nativeStreq(Stack& stack)
+{
+    auto s2 = (const char *)stack.pop().getValue();
+    long n2 = stack.pop().getValue();
+    auto s1 = (const char *)stack.pop().getValue();
+    long n1 = stack.pop().getValue();
+    stack.push(n1 == n2 && (n1 <= 0 || std::memcmp(s1, s2, n1) == 0));
+}
+
+// str-chop-by-delim int ptr ptr: delim line word. word becomes the prefix of
+// line up to the first delim, and line what follows the delim.
+static void nativeStrChopByDelim(Stack& stack)
+{
+    auto word = (Str *)stack.pop().getValue();
+    auto line = (Str *)stack.pop().getValue();
+    long delim = stack.pop().getValue();
+    char *start = line->data;
+    long n = line->count;
+    // @8 reads zero-extended bytes, so a delim outside 0..255 never matches
+    char *hit = nullptr;
+    if (n > 0 && delim >= 0 && delim <= 255)
+        hit = (char *)std::memchr(start, delim, n);
+    long len = hit ? hit - start : std::max(n, 0L);
+    word->count = len;
+    word->data = start;
+    long skip = hit ? len + 1 : len;
+    line->count = n - skip;
+    line->data = start + skip;
+}
+
+// fputu int int: value fd. Writes value as unsigned decimal in one write.
+static void nativeFputu(Stack& stack)
+{
+    long fd = stack.pop().getValue();
+    unsigned long value = stack.pop().getValue();
+    char buf[32];
+    char *p = buf + sizeof(buf);
+    do
+    {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    syscall(1, {fd, (long)p, (long)(buf + sizeof(buf) - p)});
+}
+
+const std::vector<NativeProc>& nativeProcs()
+{
+    static const TypeKind I = TypeKind::INT, P = TypeKind::PTR, B = TypeKind::BOOL;
+    static const std::vector<NativeProc> procs = {
+        {"memcpy", {I, P, P}, {P}, nativeMemcpy},
+        {"memset", {I, I, P}, {P}, nativeMemset},
+        {"cstrlen", {P}, {I}, nativeCstrlen},
+        {"cstreq", {P, P}, {B}, nativeCstreq},
+        {"streq", {I, P, I, P}, {B}, nativeStreq},
+        {"str-chop-by-delim", {I, P, P}, {}, nativeStrChopByDelim},
+        {"fputu", {I, I}, {}, nativeFputu},
+    };
+    return procs;
+}
+
+static bool sameKinds(const std::vector<Type>& types, const std::vector<TypeKind>& kinds)
+{
+    if (types.size() != kinds.size())
+        return false;
+    for (size_t i = 0; i < kinds.size(); i++)
+        if (types[i].kind != kinds[i])
+            return false;
+    return true;
+}
+
+NativeFn findNative(ProcCmd *proc)
+{
+    for (auto& n : nativeProcs())
+        if (n.name == proc->name && sameKinds(proc->sig.params, n.params) && sameKinds(proc->sig.retTypes, n.rets))
+            return n.fn;
+    return nullptr;
+}
+
+void bindNative(ProcCmd *proc)
+{
+    if (options.nativeStd && !options.checkMemory)
+        proc->native = findNative(proc);
+}
+
+// EXTERN
+
+using ExternThunk = void (*)(Stack&, void *);
+
+// Every Porth value is a 64-bit integer, so on x86-64 SysV the first six
+// arguments of any C function taking integers or pointers go in the same
+// registers as for long(long, ...), and its result comes back in rax.
+template <size_t... I>
+static long callExtern(void *fn, const long *args, std::index_sequence<I...>)
+{
+    return ((long (*)(decltype((void)I, 0L)...))fn)(args[I]...);
+}
+
+// Pops N arguments (the deepest is the first), calls fn and pushes its
+// result as ret; NONE pushes nothing. An `int` result is a C int and only
+// sets eax, so it is sign-extended; `ptr` takes all of rax (pointers, long,
+// size_t). C bool results only set al.
+enum class ExternRet { NONE, INT, PTR, BOOL };
+
+template <size_t N, ExternRet ret>
+static void externThunk(Stack& stack, void *fn)
+{
+    long args[N + 1];
+    for (size_t i = N; i-- > 0;)
+        args[i] = stack.pop().getValue();
+    long res = callExtern(fn, args, std::make_index_sequence<N>());
+    if constexpr (ret == ExternRet::INT)
+        stack.push(Data((long)(int)res, TypeKind::INT));
+    else if constexpr (ret == ExternRet::PTR)
+        stack.push(Data(res, TypeKind::PTR));
+    else if constexpr (ret == ExternRet::BOOL)
+        stack.push(Data((res & 0xff) != 0, TypeKind::BOOL));
+}
+
+static const size_t MAX_EXTERN_ARGS = 6;
+
+template <size_t... N>
+static constexpr auto makeThunks(std::index_sequence<N...>)
+{
+    return std::array<std::array<ExternThunk, 4>, sizeof...(N)>{{
+        {externThunk<N, ExternRet::NONE>, externThunk<N, ExternRet::INT>,
+         externThunk<N, ExternRet::PTR>, externThunk<N, ExternRet::BOOL>}...
+    }};
+}
+
+static const auto externThunks = makeThunks(std::make_index_sequence<MAX_EXTERN_ARGS + 1>());
+
+static void externError(ProcCmd *proc, const std::string& msg)
+{
+    std::cout << "Error:" << proc->line << ": extern " << proc->name << ": " << msg << std::endl;
+    throw new std::exception();
+}
+
+void bindExtern(ProcCmd *proc)
+{
+    auto& sig = proc->sig;
+    if (sig.params.size() > MAX_EXTERN_ARGS || sig.retTypes.size() > 1)
+        externError(proc, "at most " + std::to_string(MAX_EXTERN_ARGS) + " arguments and 1 result are supported");
+
+    ExternRet ret = ExternRet::NONE;
+    if (!sig.retTypes.empty())
+    {
+        switch (sig.retTypes[0].kind)
+        {
+            case TypeKind::INT: ret = ExternRet::INT; break;
+            case TypeKind::PTR: ret = ExternRet::PTR; break;
+            case TypeKind::BOOL: ret = ExternRet::BOOL; break;
+            default: externError(proc, "unsupported result type " + sig.retTypes[0].toString());
+        }
+    }
+
+    // Handles are reference counted by the loader and never closed, so
+    // repeated externs from one library share it.
+    void *lib = dlopen(proc->library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!lib)
+        externError(proc, dlerror());
+    dlerror();
+    void *sym = dlsym(lib, proc->name.c_str());
+    if (const char *err = dlerror())
+        externError(proc, err);
+
+    proc->symbol = sym;
+    proc->thunk = externThunks[sig.params.size()][(int)ret];
+}
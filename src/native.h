@@ -0,0 +1,34 @@
+#ifndef CPPORTH_NATIVE_H
+#define CPPORTH_NATIVE_H
+
+#include <string>
+#include <vector>
+#include "ast.h"
+
+class Stack;
+
+// A C++ version of a porth/std proc. It takes the proc's arguments from the
+// stack and leaves its results there, exactly like the Porth body would.
+using NativeFn = void (*)(Stack&);
+
+class NativeProc
+{
+public:
+    std::string name;
+    std::vector<TypeKind> params;
+    std::vector<TypeKind> rets;
+    NativeFn fn;
+};
+
+const std::vector<NativeProc>& nativeProcs();
+// The builtin with proc's name and exact signature, if any.
+NativeFn findNative(ProcCmd *);
+// Called by include for every proc it loads: points proc->native at the
+// matching builtin unless --no-native or --check-memory is set.
+void bindNative(ProcCmd *);
+// Called when an `extern` proc is loaded: dlopens proc->library, looks up
+// the symbol named like the proc and points proc->thunk at a call of the
+// signature's arity. Throws if either is missing.
+void bindExtern(ProcCmd *);
+
+#endif // CPPORTH_NATIVE_H
@@ -0,0 +1,965 @@
+#include "optimizer.h"
+#include "args.h"
+#include "ir.h"
+#include <iostream>
+#include <unordered_set>
+#include <unordered_map>
+#include <algorithm>
+
+static void walkScoped(std::vector<Expr*>& body, const std::vector<Symbol>& idents,
+    std::vector<Symbol>& bound, const BodyVisitor& f)
+{
+    bound.insert(bound.end(), idents.begin(), idents.end());
+    walkBodies(body, bound, f);
+    bound.resize(bound.size() - idents.size());
+}
+
+void walkBodies(std::vector<Expr*>& body, std::vector<Symbol>& bound, const BodyVisitor& f)
+{
+    for (auto e : body)
+    {
+        switch (e->getASTKind())
+        {
+            case ASTKind::WHILEEXPR:
+            {
+                auto w = (WhileExpr *)e;
+                walkBodies(w->cond, bound, f);
+                walkBodies(w->body, bound, f);
+                break;
+            }
+            case ASTKind::IFEXPR:
+            {
+                for (auto i = (IfExpr *)e; i; i = i->next)
+                {
+                    walkBodies(i->then, bound, f);
+                    walkBodies(i->elze, bound, f);
+                }
+                break;
+            }
+            case ASTKind::LETSTMT:
+                walkScoped(((LetExpr *)e)->body, ((LetExpr *)e)->idents, bound, f);
+                break;
+            case ASTKind::PEEKSTMT:
+                walkScoped(((PeekExpr *)e)->body, ((PeekExpr *)e)->idents, bound, f);
+                break;
+            case ASTKind::ASSERTEXPR:
+                walkBodies(((AssertExpr *)e)->body, bound, f);
+                break;
+            case ASTKind::MEMORYEXPR:
+                walkBodies(((MemoryExpr *)e)->body, bound, f);
+                break;
+            case ASTKind::MATCHSTMT:
+                for (auto& [name, binding] : ((MatchExpr *)e)->branches)
+                    walkScoped(binding->body, binding->idents, bound, f);
+                break;
+            case ASTKind::VARIANTINSTANCEEXPR:
+                for (auto& arg : ((VariantInstanceExpr *)e)->args)
+                    walkBodies(arg, bound, f);
+                break;
+            case ASTKind::ARRAYLITEXPR:
+                for (auto& item : ((ArrayLitExpr *)e)->items)
+                    walkBodies(item, bound, f);
+                break;
+            default:
+                break;
+        }
+    }
+    f(body, bound);
+}
+
+void walkBodies(std::vector<Expr*>& body, const BodyVisitor& f)
+{
+    std::vector<Symbol> bound;
+    walkBodies(body, bound, f);
+}
+
+// DEAD PROC ELIMINATION
+
+// Tokens that may name a proc in an unparsed body: identifiers, and the byte
+// builtins, which a program may define as procs (resolveShadowedBuiltins).
+static bool isNameToken(TokenType type)
+{
+    return type == TokenType::VAR || type == TokenType::MEMCHR || type == TokenType::MEMCMP
+        || type == TokenType::FINDBYTESET || type == TokenType::COUNTBYTE;
+}
+
+// Names a proc body refers to: calls, addr-of targets, and types used by new/match.
+// Unparsed (--lazy-procs) bodies are scanned token by token instead.
+static std::vector<Symbol> references(ProcCmd *proc)
+{
+    std::vector<Symbol> names;
+
+    if (!proc->parsed)
+    {
+        // A name that was never interned cannot be a defined proc or type.
+        Symbol sym;
+        for (int i = proc->bodyStart; i < proc->bodyEnd; i++)
+            if (isNameToken((*proc->source)[i].type) && findSymbol((*proc->source)[i].content, sym))
+                names.push_back(sym);
+        return names;
+    }
+
+    walkBodies(proc->body, [&](std::vector<Expr*>& body, std::vector<Symbol>&) {
+        for (auto e : body)
+        {
+            switch (e->getASTKind())
+            {
+                case ASTKind::VAREXPR:
+                    names.push_back(((VarExpr *)e)->sym);
+                    break;
+                case ASTKind::ADDROFEXPR:
+                    names.push_back(((AddrOfExpr *)e)->proc->sym);
+                    break;
+                case ASTKind::CALLLIKEEXPR:
+                    names.push_back(((CallLikeExpr *)e)->proc->sym);
+                    break;
+                case ASTKind::VARIANTINSTANCEEXPR:
+                    names.push_back(((VariantInstanceExpr *)e)->parentSym);
+                    break;
+                case ASTKind::MATCHSTMT:
+                    names.push_back(((MatchExpr *)e)->supertype);
+                    break;
+                default:
+                    break;
+            }
+        }
+    });
+    return names;
+}
+
+void eliminateDeadProcs(Env& env, const std::vector<AST*>& owned)
+{
+    std::unordered_set<Symbol> live;
+    std::vector<ProcCmd*> work;
+
+    Symbol main = intern("main");
+    if (env.isProc(main))
+    {
+        live.insert(main);
+        work.push_back(env.getProc(main));
+    }
+
+    while (!work.empty())
+    {
+        auto proc = work.back();
+        work.pop_back();
+        for (auto name : references(proc))
+        {
+            if (live.count(name))
+                continue;
+            if (env.isProc(name))
+            {
+                live.insert(name);
+                work.push_back(env.getProc(name));
+            }
+            else if (env.types.find(name) != env.types.end())
+                live.insert(name);
+        }
+    }
+
+    std::unordered_set<AST*> keep(owned.begin(), owned.end());
+
+    for (auto it = env.procs.begin(); it != env.procs.end();)
+    {
+        if (live.count(it->first))
+        {
+            ++it;
+            continue;
+        }
+        if (!keep.count(it->second))
+            delete it->second;
+        it = env.procs.erase(it);
+    }
+
+    for (auto it = env.types.begin(); it != env.types.end();)
+    {
+        if (live.count(it->first))
+        {
+            ++it;
+            continue;
+        }
+        if (!keep.count(it->second))
+            delete it->second;
+        it = env.types.erase(it);
+    }
+}
+
+// SHADOWED BUILTINS
+
+// Turns the ScanExprs whose kind has bit (1 << kind) set into calls.
+static void resolveScans(std::vector<Expr*>& body, unsigned shadowed)
+{
+    walkBodies(body, [&](std::vector<Expr*>& list, std::vector<Symbol>&) {
+        for (auto& e : list)
+        {
+            if (e->getASTKind() != ASTKind::SCANEXPR || !(shadowed & (1u << (int)((ScanExpr *)e)->kind)))
+                continue;
+            auto v = new VarExpr(((ScanExpr *)e)->name());
+            v->line = e->line;
+            delete e;
+            e = v;
+        }
+    });
+}
+
+void resolveShadowedBuiltins(Env& env)
+{
+    unsigned shadowed = 0;
+    for (auto kind : {ScanKind::MEMCHR, ScanKind::MEMCMP, ScanKind::FINDBYTESET, ScanKind::COUNTBYTE})
+        if (env.containsKey(ScanExpr(kind).name()))
+            shadowed |= 1u << (int)kind;
+    if (!shadowed)
+        return;
+
+    // Lazy bodies are resolved by prepareLazyBody when they are parsed.
+    for (auto& [name, proc] : env.procs)
+    {
+        if (proc->parsed)
+            resolveScans(proc->body, shadowed);
+        else
+            proc->shadowedScans = shadowed;
+    }
+}
+
+// CONSTANT FOLDING
+
+// The value e pushes, if it is known before execution.
+static bool immediate(Expr *e, Data& d)
+{
+    switch (e->getASTKind())
+    {
+        case ASTKind::INTEXPR:
+            d = Data(((IntExpr *)e)->getValue(), TypeKind::INT);
+            return true;
+        case ASTKind::CHAREXPR:
+            d = Data((long)((CharExpr *)e)->getValue(), TypeKind::INT);
+            return true;
+        case ASTKind::IMMEXPR:
+            d = Data(((ImmExpr *)e)->value, ((ImmExpr *)e)->type);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Number of cells a pure op pops, or -1 if it cannot be folded.
+static int foldArity(Expr *e)
+{
+    if (e->getASTKind() == ASTKind::MAXEXPR)
+        return 2;
+    if (e->getASTKind() != ASTKind::OPEXPR)
+        return -1;
+
+    switch (((OpExpr *)e)->kind)
+    {
+        case OpKind::NOT:
+        case OpKind::CASTBOOL:
+        case OpKind::CASTINT:
+        case OpKind::CASTPTR:
+            return 1;
+        case OpKind::ADD:
+        case OpKind::SUB:
+        case OpKind::MUL:
+        case OpKind::DIVMOD:
+        case OpKind::LT:
+        case OpKind::GT:
+        case OpKind::LE:
+        case OpKind::GE:
+        case OpKind::EQ:
+        case OpKind::NE:
+        case OpKind::SHR:
+        case OpKind::SHL:
+        case OpKind::OR:
+        case OpKind::AND:
+            return 2;
+        default:
+            return -1;
+    }
+}
+
+// Same results as the OPEXPR and MAXEXPR handlers in interpExpr.
+// Returns false where folding would hide a runtime fault.
+static bool foldOp(Expr *e, const std::vector<Data>& in, std::vector<Data>& out)
+{
+    long a = in[0].getValue();
+    long b = in.size() > 1 ? in[1].getValue() : 0;
+
+    if (e->getASTKind() == ASTKind::MAXEXPR)
+    {
+        out.push_back(Data(std::max(a, b), TypeKind::INT));
+        return true;
+    }
+
+    switch (((OpExpr *)e)->kind)
+    {
+        case OpKind::ADD: out.push_back(Data(a + b, TypeKind::INT)); break;
+        case OpKind::SUB: out.push_back(Data(a - b, TypeKind::INT)); break;
+        case OpKind::MUL: out.push_back(Data(a * b, TypeKind::INT)); break;
+        case OpKind::DIVMOD:
+            if (b == 0)
+                return false;
+            out.push_back(Data(a / b, TypeKind::INT));
+            out.push_back(Data(a % b, TypeKind::INT));
+            break;
+        case OpKind::LT: out.push_back(Data(a < b, TypeKind::BOOL)); break;
+        case OpKind::GT: out.push_back(Data(a > b, TypeKind::BOOL)); break;
+        case OpKind::LE: out.push_back(Data(a <= b, TypeKind::BOOL)); break;
+        case OpKind::GE: out.push_back(Data(a >= b, TypeKind::BOOL)); break;
+        case OpKind::EQ: out.push_back(Data(a == b, TypeKind::BOOL)); break;
+        case OpKind::NE: out.push_back(Data(a != b, TypeKind::BOOL)); break;
+        case OpKind::SHR:
+        case OpKind::SHL:
+            if (b < 0 || b > 63)
+                return false;
+            out.push_back(Data(((OpExpr *)e)->kind == OpKind::SHR ? a >> b : a << b, TypeKind::INT));
+            break;
+        case OpKind::OR: out.push_back(Data(a | b, TypeKind::INT)); break;
+        case OpKind::AND: out.push_back(Data(a & b, TypeKind::INT)); break;
+        case OpKind::NOT: out.push_back(Data(~a, TypeKind::INT)); break;
+        case OpKind::CASTBOOL: out.push_back(Data(a > 0, TypeKind::BOOL)); break;
+        case OpKind::CASTINT: out.push_back(Data(a, TypeKind::INT)); break;
+        case OpKind::CASTPTR: out.push_back(Data(a, TypeKind::PTR)); break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+// Appends e to out, folding it against the immediates already at the end of out.
+static void emit(std::vector<Expr*>& out, Expr *e, Env& env, std::vector<Symbol>& bound)
+{
+    if (e->getASTKind() == ASTKind::VAREXPR)
+    {
+        auto name = ((VarExpr *)e)->sym;
+        // Calls win over variables at run time; let/peek/match bindings are looked up as before.
+        if (!env.isProc(name) && env.isVariable(name)
+            && std::find(bound.begin(), bound.end(), name) == bound.end())
+        {
+            auto d = env.getVar(name);
+            auto imm = new ImmExpr(d.getValue(), d.getType());
+            imm->line = e->line;
+            delete e;
+            e = imm;
+        }
+    }
+
+    out.push_back(e);
+
+    int arity = foldArity(e);
+    if (arity > 0 && out.size() > (size_t)arity)
+    {
+        std::vector<Data> in(arity);
+        for (int i = 0; i < arity; i++)
+            if (!immediate(out[out.size() - 1 - arity + i], in[i]))
+                return;
+
+        std::vector<Data> res;
+        if (!foldOp(e, in, res))
+            return;
+
+        int line = e->line;
+        for (int i = 0; i <= arity; i++)
+        {
+            delete out.back();
+            out.pop_back();
+        }
+        for (auto d : res)
+        {
+            auto imm = new ImmExpr(d.getValue(), d.getType());
+            imm->line = line;
+            out.push_back(imm);
+        }
+        return;
+    }
+
+    if (e->getASTKind() == ASTKind::IFEXPR && out.size() > 1)
+    {
+        Data cond;
+        if (!immediate(out[out.size() - 2], cond))
+            return;
+
+        auto f = (IfExpr *)e;
+        out.pop_back();
+        delete out.back();
+        out.pop_back();
+
+        auto then = f->then;
+        auto elze = f->elze;
+        auto next = f->next;
+        f->then.clear();
+        f->elze.clear();
+        f->next = nullptr;
+        delete f;
+
+        if (cond.isTrue())
+        {
+            for (auto x : then)
+                emit(out, x, env, bound);
+            for (auto x : elze)
+                delete x;
+            if (next)
+                delete next;
+            return;
+        }
+
+        for (auto x : then)
+            delete x;
+        for (auto x : elze)
+            emit(out, x, env, bound);
+        if (next && elze.size() > 0)
+            emit(out, next, env, bound);
+        else if (next)
+            delete next;
+        return;
+    }
+
+    if (e->getASTKind() == ASTKind::WHILEEXPR)
+    {
+        auto w = (WhileExpr *)e;
+        Data cond;
+        if (w->cond.size() == 1 && immediate(w->cond[0], cond) && cond.isFalse())
+        {
+            out.pop_back();
+            delete w;
+        }
+    }
+}
+
+void foldConstants(std::vector<Expr*>& body, Env& env)
+{
+    walkBodies(body, [&](std::vector<Expr*>& list, std::vector<Symbol>& bound) {
+        std::vector<Expr*> out;
+        for (auto e : list)
+            emit(out, e, env, bound);
+        list = out;
+    });
+}
+
+// SHUFFLE ELIMINATION
+
+static bool isShuffle(Expr *e)
+{
+    switch (e->getASTKind())
+    {
+        case ASTKind::SWAPEXPR:
+        case ASTKind::DROPEXPR:
+        case ASTKind::DUPEXPR:
+        case ASTKind::OVEREXPR:
+        case ASTKind::ROTEXPR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// A single push with no side effects, so it may be repeated, dropped or reordered.
+static bool isPureProducer(Expr *e, Env& env, std::vector<Symbol>& bound)
+{
+    switch (e->getASTKind())
+    {
+        case ASTKind::INTEXPR:
+        case ASTKind::CHAREXPR:
+        case ASTKind::IMMEXPR:
+            return true;
+        case ASTKind::VAREXPR:
+        {
+            auto name = ((VarExpr *)e)->sym;
+            return !env.isProc(name) && (env.isVariable(name)
+                || std::find(bound.begin(), bound.end(), name) != bound.end());
+        }
+        default:
+            return false;
+    }
+}
+
+static Expr *cloneProducer(Expr *e)
+{
+    Expr *res;
+    switch (e->getASTKind())
+    {
+        case ASTKind::VAREXPR:
+            res = new VarExpr(((VarExpr *)e)->sym);
+            break;
+        default:
+        {
+            Data d;
+            immediate(e, d);
+            res = new ImmExpr(d.getValue(), d.getType());
+        }
+    }
+    res->line = e->line;
+    return res;
+}
+
+// What a run of shuffles does to the top of the stack. Cells are named by
+// their depth before the run (0 = top); `depth` cells are consumed.
+class ShuffleEffect
+{
+public:
+    int depth = 0;
+    std::vector<int> cells;
+
+    void need(int n)
+    {
+        while (cells.size() < (size_t)n)
+            cells.insert(cells.begin(), depth++);
+    }
+
+    void apply(Expr *e)
+    {
+        switch (e->getASTKind())
+        {
+            case ASTKind::DUPEXPR:
+                need(1);
+                cells.push_back(cells.back());
+                break;
+            case ASTKind::DROPEXPR:
+                need(1);
+                cells.pop_back();
+                break;
+            case ASTKind::SWAPEXPR:
+                need(2);
+                std::swap(cells[cells.size()-1], cells[cells.size()-2]);
+                break;
+            case ASTKind::OVEREXPR:
+                need(2);
+                cells.push_back(cells[cells.size()-2]);
+                break;
+            case ASTKind::ROTEXPR:
+            {
+                need(3);
+                int a = cells[cells.size()-3];
+                cells.erase(cells.end()-3);
+                cells.push_back(a);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    bool isIdentity()
+    {
+        if (cells.size() != (size_t)depth)
+            return false;
+        for (int i = 0; i < depth; i++)
+            if (cells[i] != depth-1-i)
+                return false;
+        return true;
+    }
+};
+
+static void emitShuffles(std::vector<Expr*>& out, std::vector<Expr*>& run, Env& env, std::vector<Symbol>& bound)
+{
+    if (run.empty())
+        return;
+
+    ShuffleEffect effect;
+    for (auto e : run)
+        effect.apply(e);
+
+    int producers = 0;
+    while (producers < effect.depth && (size_t)producers < out.size()
+        && isPureProducer(out[out.size()-1-producers], env, bound))
+        producers++;
+
+    if (producers == effect.depth)
+    {
+        // Every moved cell comes from a pure push: reorder the pushes instead.
+        std::vector<Expr*> pushes(out.end() - effect.depth, out.end());
+        out.resize(out.size() - effect.depth);
+        std::vector<bool> used(effect.depth, false);
+        for (int cell : effect.cells)
+        {
+            Expr *p = pushes[effect.depth-1-cell];
+            out.push_back(used[cell] ? cloneProducer(p) : p);
+            used[cell] = true;
+        }
+        for (int cell = 0; cell < effect.depth; cell++)
+            if (!used[cell])
+                delete pushes[effect.depth-1-cell];
+        for (auto e : run)
+            delete e;
+    }
+    else if (effect.isIdentity())
+    {
+        for (auto e : run)
+            delete e;
+    }
+    else if (run.size() == 1 || effect.depth > PermuteExpr::MAX_DEPTH)
+        out.insert(out.end(), run.begin(), run.end());
+    else
+    {
+        std::vector<int> order;
+        for (int cell : effect.cells)
+            order.push_back(effect.depth-1-cell);
+        auto p = new PermuteExpr(effect.depth, order);
+        p->line = run[0]->line;
+        out.push_back(p);
+        for (auto e : run)
+            delete e;
+    }
+    run.clear();
+}
+
+// `swap op` where op is commutative, or a comparison that can be mirrored.
+static Expr *dropSwapBefore(Expr *e)
+{
+    if (e->getASTKind() == ASTKind::MAXEXPR)
+        return e;
+    if (e->getASTKind() != ASTKind::OPEXPR)
+        return nullptr;
+
+    std::string mirrored;
+    switch (((OpExpr *)e)->kind)
+    {
+        case OpKind::ADD:
+        case OpKind::MUL:
+        case OpKind::EQ:
+        case OpKind::NE:
+        case OpKind::AND:
+        case OpKind::OR:
+            return e;
+        case OpKind::LT: mirrored = ">"; break;
+        case OpKind::GT: mirrored = "<"; break;
+        case OpKind::LE: mirrored = ">="; break;
+        case OpKind::GE: mirrored = "<="; break;
+        default:
+            return nullptr;
+    }
+    auto op = new OpExpr(mirrored);
+    op->line = e->line;
+    delete e;
+    return op;
+}
+
+void eliminateShuffles(std::vector<Expr*>& body, Env& env)
+{
+    walkBodies(body, [&](std::vector<Expr*>& list, std::vector<Symbol>& bound) {
+        std::vector<Expr*> out;
+        std::vector<Expr*> run;
+        for (auto e : list)
+        {
+            if (isShuffle(e))
+            {
+                run.push_back(e);
+                continue;
+            }
+            if (run.size() == 1 && run[0]->getASTKind() == ASTKind::SWAPEXPR)
+            {
+                if (auto op = dropSwapBefore(e))
+                {
+                    delete run[0];
+                    run.clear();
+                    e = op;
+                }
+            }
+            emitShuffles(out, run, env, bound);
+            out.push_back(e);
+        }
+        emitShuffles(out, run, env, bound);
+        list = out;
+    });
+}
+
+static OpKind opKindOf(Expr *e)
+{
+    return e->getASTKind() == ASTKind::OPEXPR ? ((OpExpr *)e)->kind : OpKind::UNKNOWN;
+}
+
+// COMPARE AND BRANCH
+
+static bool isComparison(OpKind kind)
+{
+    return kind == OpKind::LT || kind == OpKind::GT || kind == OpKind::LE
+        || kind == OpKind::GE || kind == OpKind::EQ || kind == OpKind::NE;
+}
+
+// Removes the comparison ending cond, if any, leaving at least `keep` expressions.
+static OpKind takeComparison(std::vector<Expr*>& cond, size_t keep)
+{
+    if (cond.size() <= keep || !isComparison(opKindOf(cond.back())))
+        return OpKind::UNKNOWN;
+    OpKind kind = opKindOf(cond.back());
+    delete cond.back();
+    cond.pop_back();
+    return kind;
+}
+
+void fuseBranches(std::vector<Expr*>& body)
+{
+    walkBodies(body, [&](std::vector<Expr*>& list, std::vector<Symbol>&) {
+        std::vector<Expr*> out;
+        for (auto e : list)
+        {
+            if (e->getASTKind() == ASTKind::WHILEEXPR)
+            {
+                auto w = (WhileExpr *)e;
+                if (w->cmp == OpKind::UNKNOWN)
+                    w->cmp = takeComparison(w->cond, 0);
+            }
+            else if (e->getASTKind() == ASTKind::IFEXPR)
+            {
+                auto f = (IfExpr *)e;
+                if (f->cmp == OpKind::UNKNOWN)
+                    f->cmp = takeComparison(out, 0);
+                // An if* only runs after a non-empty else, so keep one expression there.
+                for (; f->next; f = f->next)
+                    if (f->next->cmp == OpKind::UNKNOWN)
+                        f->next->cmp = takeComparison(f->elze, 1);
+            }
+            out.push_back(e);
+        }
+        list = out;
+    });
+}
+
+// SUPERINSTRUCTIONS
+
+// over over, either as written or as the permutation eliminateShuffles leaves behind.
+static bool isOverOver(std::vector<Expr*>& out)
+{
+    if (out.empty())
+        return false;
+    auto last = out.back();
+    if (last->getASTKind() == ASTKind::PERMUTEEXPR)
+    {
+        auto p = (PermuteExpr *)last;
+        return p->depth == 2 && p->order == std::vector<int>{0, 1, 0, 1};
+    }
+    return out.size() >= 2 && last->getASTKind() == ASTKind::OVEREXPR
+        && out[out.size()-2]->getASTKind() == ASTKind::OVEREXPR;
+}
+
+// Replaces the last n expressions of out with s.
+static void replaceTail(std::vector<Expr*>& out, int n, SuperExpr *s)
+{
+    s->line = out[out.size()-n]->line;
+    for (int i = 0; i < n; i++)
+    {
+        delete out.back();
+        out.pop_back();
+    }
+    out.push_back(s);
+}
+
+// Appends e to out, fusing it with the expressions before it where possible.
+static void fuse(std::vector<Expr*>& out, Expr *e)
+{
+    OpKind kind = opKindOf(e);
+    Expr *prev = out.empty() ? nullptr : out.back();
+
+    switch (kind)
+    {
+        case OpKind::ADD:
+        case OpKind::SUB:
+        {
+            Data d;
+            if (prev && immediate(prev, d))
+            {
+                auto s = new SuperExpr(SuperKind::ADDIMM);
+                s->imm = kind == OpKind::ADD ? d.getValue() : -d.getValue();
+                replaceTail(out, 1, s);
+                delete e;
+                return;
+            }
+            break;
+        }
+
+        case OpKind::LOAD8:
+        case OpKind::LOAD16:
+        case OpKind::LOAD32:
+        case OpKind::LOAD64:
+            // Loads ignore the pointer's type, so a cast right before one is dead.
+            if (prev && opKindOf(prev) == OpKind::CASTPTR)
+            {
+                e->line = prev->line;
+                delete prev;
+                out.pop_back();
+                prev = out.empty() ? nullptr : out.back();
+            }
+            if (prev && prev->getASTKind() == ASTKind::DUPEXPR
+                && (kind == OpKind::LOAD8 || kind == OpKind::LOAD64))
+            {
+                replaceTail(out, 1, new SuperExpr(kind == OpKind::LOAD8 ? SuperKind::DUPLOAD8 : SuperKind::DUPLOAD64));
+                delete e;
+                return;
+            }
+            break;
+
+        case OpKind::LT:
+        case OpKind::GT:
+        case OpKind::LE:
+        case OpKind::GE:
+        case OpKind::EQ:
+        case OpKind::NE:
+            if (isOverOver(out))
+            {
+                auto s = new SuperExpr(SuperKind::OVEROVERCMP);
+                s->cmp = kind;
+                replaceTail(out, out.back()->getASTKind() == ASTKind::PERMUTEEXPR ? 1 : 2, s);
+                delete e;
+                return;
+            }
+            break;
+
+        case OpKind::STORE8:
+        case OpKind::STORE64:
+            if (prev && prev->getASTKind() == ASTKind::SWAPEXPR)
+            {
+                replaceTail(out, 1, new SuperExpr(kind == OpKind::STORE8 ? SuperKind::SWAPSTORE8 : SuperKind::SWAPSTORE64));
+                delete e;
+                return;
+            }
+            break;
+
+        default:
+            break;
+    }
+    out.push_back(e);
+}
+
+void fuseSuperinstructions(std::vector<Expr*>& body)
+{
+    walkBodies(body, [&](std::vector<Expr*>& list, std::vector<Symbol>&) {
+        std::vector<Expr*> out;
+        for (auto e : list)
+            fuse(out, e);
+        list = out;
+    });
+}
+
+void markDroppedSyscalls(std::vector<Expr*>& body)
+{
+    walkBodies(body, [&](std::vector<Expr*>& list, std::vector<Symbol>&) {
+        for (size_t i = 0; i + 1 < list.size(); i++)
+            if (list[i]->getASTKind() == ASTKind::SYSCALLEXPR && list[i+1]->getASTKind() == ASTKind::DROPEXPR)
+                ((SyscallExpr *)list[i])->resultUsed = false;
+    });
+}
+
+static void markTailSyscall(std::vector<Expr*>& body)
+{
+    if (!body.empty() && body.back()->getASTKind() == ASTKind::SYSCALLEXPR)
+        ((SyscallExpr *)body.back())->resultUsed = false;
+}
+
+void markDroppedResults(Env& env)
+{
+    // kept: some use may read the result. tailCallers: procs that return
+    // the result as their own, so it is dropped when theirs is.
+    std::unordered_set<ProcCmd*> kept;
+    std::unordered_map<ProcCmd*, std::vector<ProcCmd*>> tailCallers;
+    if (env.isProc("main"))
+        kept.insert(env.getProc("main"));
+
+    for (auto& [name, proc] : env.procs)
+    {
+        if (!proc->parsed)
+        {
+            // Read the tokens: a call is dropped when drop follows it and a
+            // tail call when the proc's closing end (the last token) does.
+            auto& tokens = *proc->source;
+            for (int i = proc->bodyStart; i < proc->bodyEnd; i++)
+            {
+                Symbol sym;
+                if (!isNameToken(tokens[i].type) || !findSymbol(tokens[i].content, sym) || !env.isProc(sym))
+                    continue;
+                int next = i + 1;
+                while (next < proc->bodyEnd && tokens[next].type == TokenType::NEWLINE)
+                    next++;
+                if (next == proc->bodyEnd - 1)
+                    tailCallers[env.getProc(sym)].push_back(proc);
+                else if (next == proc->bodyEnd || tokens[next].type != TokenType::DROP)
+                    kept.insert(env.getProc(sym));
+            }
+            continue;
+        }
+
+        walkBodies(proc->body, [&](std::vector<Expr*>& list, std::vector<Symbol>& bound) {
+            for (size_t i = 0; i < list.size(); i++)
+            {
+                auto e = list[i];
+                if (e->getASTKind() == ASTKind::ADDROFEXPR && env.isProc(((AddrOfExpr *)e)->proc->sym))
+                    kept.insert(env.getProc(((AddrOfExpr *)e)->proc->sym));
+                else if (e->getASTKind() == ASTKind::CALLLIKEEXPR && env.isProc(((CallLikeExpr *)e)->proc->sym))
+                    kept.insert(env.getProc(((CallLikeExpr *)e)->proc->sym));
+                if (e->getASTKind() != ASTKind::VAREXPR)
+                    continue;
+                Symbol sym = ((VarExpr *)e)->sym;
+                if (!env.isProc(sym) || std::find(bound.begin(), bound.end(), sym) != bound.end())
+                    continue;
+                if (i + 1 < list.size() && list[i+1]->getASTKind() == ASTKind::DROPEXPR)
+                    continue;
+                if (&list == &proc->body && i + 1 == list.size())
+                    tailCallers[env.getProc(sym)].push_back(proc);
+                else
+                    kept.insert(env.getProc(sym));
+            }
+        });
+    }
+
+    std::unordered_set<ProcCmd*> dropped;
+    for (auto& [name, proc] : env.procs)
+        if (!kept.count(proc))
+            dropped.insert(proc);
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (auto it = dropped.begin(); it != dropped.end();)
+        {
+            auto& callers = tailCallers[*it];
+            if (std::all_of(callers.begin(), callers.end(), [&](ProcCmd *c) { return dropped.count(c) > 0; }))
+            {
+                ++it;
+                continue;
+            }
+            it = dropped.erase(it);
+            changed = true;
+        }
+    }
+
+    for (auto& [name, proc] : env.procs)
+    {
+        proc->resultDropped = dropped.count(proc) > 0;
+        if (proc->resultDropped && proc->parsed)
+            markTailSyscall(proc->body);
+    }
+}
+
+void prepareLazyBody(ProcCmd *proc)
+{
+    if (proc->shadowedScans)
+        resolveScans(proc->body, proc->shadowedScans);
+    markDroppedSyscalls(proc->body);
+    if (proc->resultDropped)
+        markTailSyscall(proc->body);
+}
+
+void optimize(Env& env, const std::vector<AST*>& owned)
+{
+    resolveShadowedBuiltins(env);
+    if (options.deadProcElim)
+        eliminateDeadProcs(env, owned);
+    markDroppedResults(env);
+
+    for (auto& [name, proc] : env.procs)
+    {
+        if (!proc->parsed)
+            continue;
+        if (options.shuffleElim)
+            eliminateShuffles(proc->body, env);
+        if (options.constFold)
+            foldConstants(proc->body, env);
+        // Fusion hides the sequences --ngrams is meant to count.
+        if (options.superinstructions && !options.ngrams)
+        {
+            fuseBranches(proc->body);
+            fuseSuperinstructions(proc->body);
+        }
+        markDroppedSyscalls(proc->body);
+    }
+
+    if (options.ir || options.dumpIR)
+        lowerProcs(env, options.dumpIR ? &std::cerr : nullptr, options.ir);
+}
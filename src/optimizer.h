@@ -0,0 +1,57 @@
+#ifndef CPPORTH_OPTIMIZER_H
+#define CPPORTH_OPTIMIZER_H
+
+#include <functional>
+#include "runtime.h"
+
+// Whole-program passes run by interp() after all includes are resolved
+// and before main is called.
+void optimize(Env&, const std::vector<AST*>&);
+
+// Turns uses of memchr, memcmp, find-byte-set and count-byte back into calls
+// where the program defines a proc, const or memory with that name.
+void resolveShadowedBuiltins(Env&);
+
+// Drops procs and types that cannot be reached from main.
+// ASTs in the given list are owned by the caller and are not deleted.
+void eliminateDeadProcs(Env&, const std::vector<AST*>&);
+
+// Substitutes global consts and memory addresses into proc bodies as
+// immediates, folds pure ops on immediates and removes branches whose
+// condition is known.
+void foldConstants(std::vector<Expr*>&, Env&);
+
+// Visits an expression list together with the names let/peek/match bind around it.
+typedef std::function<void(std::vector<Expr*>&, std::vector<Symbol>&)> BodyVisitor;
+
+// Collapses runs of swap/rot/over/dup/drop into single permutations, and
+// removes them where the cells they move are pure pushes or feed a
+// commutative op.
+void eliminateShuffles(std::vector<Expr*>&, Env&);
+
+// Moves a comparison that directly feeds an if, if* or while test into the
+// branch itself (IfExpr::cmp, WhileExpr::cmp) so no bool is pushed.
+void fuseBranches(std::vector<Expr*>&);
+
+// Replaces frequent sequences (k +, dup @64, over over <, swap !64, ...)
+// with single SuperExpr handlers. Runs last, on already folded bodies.
+void fuseSuperinstructions(std::vector<Expr*>&);
+
+// Marks each syscall directly followed by drop, so --io-uring can queue it.
+void markDroppedSyscalls(std::vector<Expr*>&);
+
+// Finds the procs whose result every call site drops, directly or by
+// returning it from a proc whose result is dropped (std's write, called as
+// `write drop` by fputs), and marks a syscall ending their body like one
+// followed by drop. Sets ProcCmd::resultDropped for bodies parsed later.
+void markDroppedResults(Env&);
+
+// Runs resolveShadowedBuiltins and the marking above on a --lazy-procs body
+// when getBody parses it.
+void prepareLazyBody(ProcCmd *);
+
+// Calls f on every expression list nested in body, innermost first, then on body itself.
+void walkBodies(std::vector<Expr*>&, const BodyVisitor&);
+void walkBodies(std::vector<Expr*>&, std::vector<Symbol>&, const BodyVisitor&);
+
+#endif // CPPORTH_OPTIMIZER_H
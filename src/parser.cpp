@@ -1,5 +1,6 @@
 #include "parser.h"
 #include "helper.h"
+#include "profiler.h"
 #include <unordered_map>
 #include <utility>
 
@@ -26,7 +27,17 @@ void check(Token t, TokenType tt)
     }
 }
 
-Parser::Parser(std::vector<Token> input) : input(input), index(0) {;}
+// Definitions may still take the names of the byte builtins, which became
+// keywords later; see resolveShadowedBuiltins.
+static void checkName(Token t)
+{
+    if (t.type == TokenType::MEMCHR || t.type == TokenType::MEMCMP
+        || t.type == TokenType::FINDBYTESET || t.type == TokenType::COUNTBYTE)
+        return;
+    check(t, TokenType::VAR);
+}
+
+Parser::Parser(std::vector<Token> input, bool lazy) : input(std::move(input)), index(0), lazy(lazy) {;}
 void Parser::cleanup(std::vector<AST*> asts)
 {
     for (AST *a : asts)
@@ -180,7 +191,7 @@ IfExpr *Parser::parseIf()
 AddrOfExpr *Parser::parseAddrOf()
 {
     index++;
-    check(peek(), TokenType::VAR);
+    checkName(peek());
     auto v = new VarExpr(peek().content);
     index++;
     return new AddrOfExpr(v);
@@ -189,7 +200,7 @@ AddrOfExpr *Parser::parseAddrOf()
 CallLikeExpr *Parser::parseCallLike()
 {
     index++;
-    check(peek(), TokenType::VAR);
+    checkName(peek());
     auto v = new VarExpr(peek().content);
     index++;
     return new CallLikeExpr(v);
@@ -220,6 +231,8 @@ std::vector<Expr *> Parser::parseExpr()
         TokenType::RESET, TokenType::MEMORY, TokenType::ASSERT, 
         TokenType::ADDROF, TokenType::CALLLIKE, TokenType::FREE,
         TokenType::ALLOC, TokenType::NEW, TokenType::MATCH,
+        TokenType::MEMCHR, TokenType::MEMCMP, TokenType::FINDBYTESET,
+        TokenType::COUNTBYTE,
     };
 
     while (std::find(allowed.begin(), allowed.end(), t.type) != allowed.end())
@@ -236,12 +249,16 @@ std::vector<Expr *> Parser::parseExpr()
                 break;
             case TokenType::INTVAL:
             {
-                subexps.push_back(new IntExpr((long)std::stol(t.content)));
+                auto e = new IntExpr((long)std::stol(t.content));
+                e->line = t.line;
+                subexps.push_back(e);
                 break;
             }
             case TokenType::CHAR:
             {
-                subexps.push_back(new CharExpr(realChar(t.content)));
+                auto e = new CharExpr(realChar(t.content));
+                e->line = t.line;
+                subexps.push_back(e);
                 break;
             }
             case TokenType::NEW:
@@ -274,6 +291,18 @@ std::vector<Expr *> Parser::parseExpr()
                 subexps.push_back(f);
                 break;
             }
+            case TokenType::MEMCHR:
+            case TokenType::MEMCMP:
+            case TokenType::FINDBYTESET:
+            case TokenType::COUNTBYTE:
+            {
+                auto s = new ScanExpr(t.type == TokenType::MEMCHR ? ScanKind::MEMCHR
+                    : t.type == TokenType::MEMCMP ? ScanKind::MEMCMP
+                    : t.type == TokenType::FINDBYTESET ? ScanKind::FINDBYTESET : ScanKind::COUNTBYTE);
+                s->line = t.line;
+                subexps.push_back(s);
+                break;
+            }
             case TokenType::OFFSET:
             {
                 auto e = new OffsetExpr();
@@ -698,7 +727,7 @@ ConstCmd *Parser::parseConst()
 {
     index++;
     Token identToken = pop();
-    check(identToken, TokenType::VAR);
+    checkName(identToken);
     std::string ident = identToken.content;
     std::vector<Expr *> expr = parseExpr();
     check(pop(), TokenType::END);
@@ -729,19 +758,88 @@ FnSignature Parser::parseSignature()
 ProcCmd *Parser::parseProc()
 {
     index++;
-    check(peek(), TokenType::VAR);
+    checkName(peek());
     std::string ident = pop().content;
     FnSignature sig = parseSignature();
+    if (lazy)
+    {
+        int start = index;
+        auto p = new ProcCmd(ident, sig, start, skimBody());
+        skimmed.push_back(p);
+        return p;
+    }
     std::vector<Expr*> body = parseExpr();
     check(pop(), TokenType::END);
     return new ProcCmd(ident, sig, body);
 }
 
+// extern "lib" "symbol" int int -- int
+// A proc named symbol with no body; the signature runs to the end of the line.
+// bindExtern resolves it when it is loaded.
+ProcCmd *Parser::parseExtern()
+{
+    index++;
+    check(peek(), TokenType::STRING);
+    std::string library = realString(pop().content);
+    check(peek(), TokenType::STRING);
+    std::string symbol = realString(pop().content);
+
+    std::vector<Type> ins;
+    std::vector<Type> outs;
+    bool in = true;
+    while (peek().type != TokenType::NEWLINE && peek().type != TokenType::END_OF_FILE)
+    {
+        if (peek().type == TokenType::BIKESHEDDER) { in = false; index++; continue; }
+
+        Type type = parseType();
+
+        if (in) ins.push_back(type);
+        else outs.push_back(type);
+    }
+
+    auto p = new ProcCmd(symbol, FnSignature(ins, outs), std::vector<Expr*>());
+    p->library = library;
+    return p;
+}
+
+// Skips a proc body up to and including its matching `end` without
+// building any AST, and returns the index just past it.
+// ProcCmd::getBody() parses the skipped tokens on first call.
+int Parser::skimBody()
+{
+    int depth = 1;
+    while (depth > 0 && index < input.size())
+    {
+        const Token& t = input[index++];
+        switch (t.type)
+        {
+            case TokenType::IF:
+            case TokenType::WHILE:
+            case TokenType::LET:
+            case TokenType::PEEK:
+            case TokenType::MEMORY:
+            case TokenType::ASSERT:
+            case TokenType::MATCH:
+                depth++;
+                break;
+            case TokenType::END:
+                depth--;
+                break;
+            case TokenType::END_OF_FILE:
+                std::cout << "ParseError:" << t.line << ": unterminated proc body." << std::endl;
+                throw new std::exception();
+            default:
+                break;
+        }
+    }
+    return index;
+}
+
 MemoryCmd *Parser::parseMemory()
 {
     index++;
     Token t = peek();
-    check(t, TokenType::VAR);
+    checkName(t);
     std::string ident = t.content;
     index++;
     std::vector<Expr *> e = parseExpr();
@@ -762,6 +860,7 @@ IncludeCmd *Parser::parseInclude()
 
 std::vector<AST*> Parser::parse()
 {
+    TraceScope trace("Parser::parse");
     std::vector<AST*> asts;
 
     while (index < input.size())
@@ -803,6 +902,13 @@ std::vector<AST*> Parser::parse()
                 asts.push_back(e);
                 break;
             }
+            case TokenType::EXTERN:
+            {
+                auto e = parseExtern();
+                e->line = token.line;
+                asts.push_back(e);
+                break;
+            }
             case TokenType::ASSERT:
             {
                 auto e = parseAssert()->asCmd();
@@ -833,6 +939,15 @@ std::vector<AST*> Parser::parse()
     }
 endloop:
 
+    // Skimmed procs share the token stream instead of copying their bodies.
+    if (!skimmed.empty())
+    {
+        auto source = std::make_shared<std::vector<Token> >(std::move(input));
+        for (auto p : skimmed)
+            p->source = source;
+        skimmed.clear();
+    }
+
     return asts;
 }
 
@@ -8,8 +8,10 @@ class Parser
 {
     int index;  
     std::vector<Token> input;
+    bool lazy;
+    std::vector<ProcCmd*> skimmed;
 public:
-    Parser(std::vector<Token>);
+    Parser(std::vector<Token>, bool lazy = false);
     std::vector<AST*> parse();
     void cleanup(std::vector<AST*>);
     Token peek();
@@ -21,6 +23,7 @@ public:
     ConstCmd *parseConst();
     MemoryCmd *parseMemory();
     ProcCmd *parseProc();
+    int skimBody();
     LetExpr *parseLet();
     PeekExpr *parsePeek();
     AssertExpr *parseAssert();
@@ -37,6 +40,9 @@ public:
     std::vector<Expr *> parseExpr();
     Type parseType();
     FnSignature parseSignature();
+    ProcCmd *parseExtern();
 };
 
+void check(Token, TokenType);
+
 #endif // PARSER_H
\ No newline at end of file
@@ -0,0 +1,466 @@
+#include "profiler.h"
+#include "args.h"
+#include <atomic>
+#include <map>
+#include <csignal>
+#include <cstring>
+#include <sys/time.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <fstream>
+
+class ProcProfile
+{
+public:
+    long calls = 0;
+    long active = 0;
+    long long inclusive = 0;
+    long long exclusive = 0;
+    std::vector<long> callers;      // by caller id; 0 is the top level
+};
+
+class ProfileEntry
+{
+public:
+    ProcCmd *proc;
+    long long start;
+    long long children = 0;
+};
+
+// By proc id, grown to the proc table when a proc first shows up, so a call
+// costs two vector indexes instead of hash lookups.
+static std::vector<ProcProfile> profiles;
+static std::vector<ProfileEntry> callStack;
+
+static void countCall(ProcCmd *proc, ProcCmd *caller)
+{
+    if (proc->id >= (long)profiles.size())
+        profiles.resize(ProcCmd::table.size());
+    auto& p = profiles[proc->id];
+    if (p.callers.empty())
+        p.callers.resize(ProcCmd::table.size());
+    long from = caller ? caller->id : 0;
+    if (from >= (long)p.callers.size())
+        p.callers.resize(ProcCmd::table.size());
+    p.calls++;
+    p.active++;
+    p.callers[from]++;
+}
+
+static long long steadyNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#if defined(__x86_64__)
+// Two clock reads per call cost more than a short proc body, so on x86-64
+// the profiler reads the TSC and scales it by a rate measured once, over
+// 2 ms, the first time it needs the time.
+static long long tscBase = 0, nsBase = 0;
+static double nsPerTick = 0;
+
+static void calibrate()
+{
+    long long ns0 = steadyNs(), tsc0 = __rdtsc();
+    while (steadyNs() - ns0 < 2000000)
+        ;
+    nsPerTick = double(steadyNs() - ns0) / double(__rdtsc() - tsc0);
+    tscBase = __rdtsc();
+    nsBase = steadyNs();
+}
+
+static long long now()
+{
+    if (__builtin_expect(nsPerTick == 0, 0))
+        calibrate();
+    return nsBase + (long long)((long long)(__rdtsc() - tscBase) * nsPerTick);
+}
+#else
+static long long now()
+{
+    return steadyNs();
+}
+#endif
+
+// HEAP
+
+class HeapSite
+{
+public:
+    std::string label;
+    long allocs = 0;
+    long long bytes = 0;
+    long live = 0;
+    long long liveBytes = 0;
+    long long peakBytes = 0;
+};
+
+static std::unordered_map<std::string, HeapSite> heapSites;
+static std::unordered_map<const void*, std::pair<HeapSite*, long> > heapLive;
+
+void heapAlloc(const void *ptr, long size, const char *kind, const std::string& file, ProcCmd *proc, int line)
+{
+    auto label = std::string(kind) + " at " + file + ":" + std::to_string(line)
+        + " (" + (proc ? proc->name : "<top>") + ")";
+    auto& site = heapSites[label];
+    site.label = label;
+    site.allocs++;
+    site.bytes += size;
+    site.live++;
+    site.liveBytes += size;
+    site.peakBytes = std::max(site.peakBytes, site.liveBytes);
+    heapLive[ptr] = std::make_pair(&site, size);
+}
+
+void heapFree(const void *ptr)
+{
+    auto it = heapLive.find(ptr);
+    if (it == heapLive.end())
+        return;
+    auto [site, size] = it->second;
+    site->live--;
+    site->liveBytes -= size;
+    heapLive.erase(it);
+}
+
+void dumpHeapProfile(std::ostream& out)
+{
+    std::vector<HeapSite*> sites;
+    for (auto& [label, site] : heapSites)
+        sites.push_back(&site);
+
+    std::sort(sites.begin(), sites.end(), [](auto a, auto b) {
+        return a->peakBytes != b->peakBytes ? a->peakBytes > b->peakBytes : a->label < b->label;
+    });
+    out << std::setw(12) << "peak bytes" << std::setw(10) << "allocs" << std::setw(14) << "total bytes" << "  site\n";
+    for (auto s : sites)
+        out << std::setw(12) << s->peakBytes << std::setw(10) << s->allocs << std::setw(14) << s->bytes
+            << "  " << s->label << "\n";
+
+    std::sort(sites.begin(), sites.end(), [](auto a, auto b) {
+        return a->liveBytes != b->liveBytes ? a->liveBytes > b->liveBytes : a->label < b->label;
+    });
+    out << "unfreed at exit:\n";
+    for (auto s : sites)
+        if (s->live)
+            out << std::setw(12) << s->liveBytes << " bytes in " << s->live << " blocks  " << s->label << "\n";
+}
+
+// TRACE
+
+class TraceEvent
+{
+public:
+    std::string name;
+    const char *cat;
+    long long start;
+    long long dur;
+};
+
+static std::vector<TraceEvent> traceEvents;
+
+static void addTraceEvent(const std::string& name, const char *cat, long long start, long long dur)
+{
+    traceEvents.push_back(TraceEvent{name, cat, start, dur});
+}
+
+TraceScope::TraceScope(const std::string& name) : name(name), start(options.trace.empty() ? 0 : now()) {;}
+
+TraceScope::~TraceScope()
+{
+    if (!options.trace.empty())
+        addTraceEvent(name, "load", start, now() - start);
+}
+
+static std::string jsonString(const std::string& s)
+{
+    std::string res = "\"";
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            res.push_back('\\');
+        if ((unsigned char)c < 0x20)
+            continue;
+        res.push_back(c);
+    }
+    return res + "\"";
+}
+
+bool writeTrace(const std::string& path)
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+        return false;
+
+    long long base = traceEvents.empty() ? 0 : traceEvents[0].start;
+    for (auto& e : traceEvents)
+        base = std::min(base, e.start);
+
+    out << "{\"traceEvents\": [\n";
+    out << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < traceEvents.size(); i++)
+    {
+        auto& e = traceEvents[i];
+        out << "  {\"name\": " << jsonString(e.name) << ", \"cat\": \"" << e.cat
+            << "\", \"ph\": \"X\", \"ts\": " << (e.start - base) / 1e3
+            << ", \"dur\": " << e.dur / 1e3 << ", \"pid\": 1, \"tid\": 1}"
+            << (i + 1 < traceEvents.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+    return true;
+}
+
+// SAMPLING
+
+// The shadow stack is written only by the interpreter thread and read only by
+// the SIGPROF handler interrupting it, so a signal fence between storing a
+// frame and publishing the new depth is enough.
+static const int MAX_SHADOW = 1 << 16;
+static ProcCmd *shadow[MAX_SHADOW];
+static std::atomic<int> shadowDepth(0);
+volatile int sampleLine = 0;
+
+std::atomic<bool> sampleNeedsBuffer(false);
+
+class Sample
+{
+public:
+    size_t offset;      // into the chunk's frames
+    int depth;
+    int line;
+};
+
+// Samples go into a list of chunks. The handler cannot allocate, so it always
+// has a spare chunk to move to when the current one fills; the interpreter
+// replaces the spare in refillSamples when sampleNeedsBuffer is set.
+class SampleChunk
+{
+public:
+    std::vector<Sample> samples;
+    std::vector<ProcCmd*> frames;
+    size_t count = 0;
+    size_t framesUsed = 0;
+    SampleChunk *next = nullptr;
+
+    SampleChunk(size_t nsamples, size_t nframes) : samples(nsamples), frames(nframes) {}
+};
+
+static size_t chunkSamples = 0;
+static size_t chunkFrames = 0;
+static SampleChunk *firstChunk = nullptr;
+static SampleChunk *curChunk = nullptr;
+static std::atomic<SampleChunk*> spareChunk(nullptr);
+static long samplesDropped = 0;
+
+static void shadowPush(ProcCmd *proc)
+{
+    int d = shadowDepth.load(std::memory_order_relaxed);
+    if (d < MAX_SHADOW)
+        shadow[d] = proc;
+    std::atomic_signal_fence(std::memory_order_release);
+    shadowDepth.store(d + 1, std::memory_order_relaxed);
+}
+
+static void shadowPop()
+{
+    shadowDepth.store(shadowDepth.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+}
+
+static void onSample(int)
+{
+    int d = std::min(shadowDepth.load(std::memory_order_relaxed), MAX_SHADOW);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    SampleChunk *c = curChunk;
+    if (c->count == c->samples.size() || c->framesUsed + d > c->frames.size())
+    {
+        SampleChunk *next = spareChunk.exchange(nullptr, std::memory_order_relaxed);
+        sampleNeedsBuffer.store(true, std::memory_order_relaxed);
+        if (!next)
+        {
+            samplesDropped++;
+            return;
+        }
+        c->next = next;
+        curChunk = c = next;
+    }
+    std::memcpy(c->frames.data() + c->framesUsed, shadow, d * sizeof(ProcCmd*));
+    c->samples[c->count++] = Sample{c->framesUsed, d, sampleLine};
+    c->framesUsed += d;
+}
+
+void refillSamples()
+{
+    // Clear the request first: if the handler takes the new spare before we
+    // return, it sets the flag again.
+    sampleNeedsBuffer.store(false, std::memory_order_relaxed);
+    if (!spareChunk.load(std::memory_order_relaxed))
+        spareChunk.store(new SampleChunk(chunkSamples, chunkFrames), std::memory_order_relaxed);
+}
+
+void startSampling(long hz)
+{
+    // A chunk holds about a second of samples, and at least one full shadow
+    // stack.
+    chunkSamples = std::max(256L, hz);
+    chunkFrames = std::max((size_t)MAX_SHADOW, chunkSamples * 16);
+    firstChunk = curChunk = new SampleChunk(chunkSamples, chunkFrames);
+    spareChunk.store(new SampleChunk(chunkSamples, chunkFrames));
+
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSample;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, nullptr);
+
+    long us = std::max(1L, 1000000 / hz);
+    itimerval timer;
+    timer.it_interval.tv_sec = us / 1000000;
+    timer.it_interval.tv_usec = us % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+void dumpSamples(std::ostream& out)
+{
+    itimerval off;
+    std::memset(&off, 0, sizeof(off));
+    setitimer(ITIMER_PROF, &off, nullptr);
+
+    std::map<std::string, long> folded;
+    for (SampleChunk *c = firstChunk; c; c = c->next)
+    {
+        for (size_t i = 0; i < c->count; i++)
+        {
+            auto& s = c->samples[i];
+            std::string stack;
+            for (int k = 0; k < s.depth; k++)
+                stack += (k ? ";" : "") + c->frames[s.offset + k]->name;
+            if (s.depth == 0)
+                stack = "<top>";
+            else
+                stack += ";" + c->frames[s.offset + s.depth - 1]->name + ":" + std::to_string(s.line);
+            folded[stack]++;
+        }
+    }
+    for (auto& [stack, count] : folded)
+        out << stack << " " << count << "\n";
+    if (samplesDropped)
+        std::cerr << "Warning: " << samplesDropped << " samples dropped, buffers full." << std::endl;
+
+    while (firstChunk)
+    {
+        SampleChunk *next = firstChunk->next;
+        delete firstChunk;
+        firstChunk = next;
+    }
+    curChunk = nullptr;
+    delete spareChunk.exchange(nullptr);
+    sampleNeedsBuffer.store(false);
+    samplesDropped = 0;
+}
+
+// TIMING
+
+bool tracingCalls()
+{
+    return options.profile || options.sampleHz > 0 || !options.trace.empty();
+}
+
+void profileEnter(ProcCmd *proc)
+{
+    if (options.sampleHz)
+        shadowPush(proc);
+    if (!options.profile && options.trace.empty())
+        return;
+    countCall(proc, callStack.empty() ? nullptr : callStack.back().proc);
+    callStack.push_back(ProfileEntry{proc, now()});
+}
+
+void profileTailCall(ProcCmd *proc)
+{
+    if (options.sampleHz)
+    {
+        shadowPop();
+        shadowPush(proc);
+    }
+    if (!options.profile && options.trace.empty())
+        return;
+    auto caller = callStack.back().proc;
+    profileExit();
+    countCall(proc, caller);
+    callStack.push_back(ProfileEntry{proc, now()});
+}
+
+void profileExit()
+{
+    if (options.sampleHz)
+        shadowPop();
+    if (!options.profile && options.trace.empty())
+        return;
+    auto e = callStack.back();
+    callStack.pop_back();
+    long long elapsed = now() - e.start;
+    if (!options.trace.empty() && elapsed >= options.traceMinUs * 1000)
+        addTraceEvent(e.proc->name, "proc", e.start, elapsed);
+
+    auto& p = profiles[e.proc->id];
+    p.exclusive += elapsed - e.children;
+    if (--p.active == 0)
+        p.inclusive += elapsed;
+    if (!callStack.empty())
+        callStack.back().children += elapsed;
+}
+
+static std::string procName(ProcCmd *proc)
+{
+    return proc ? proc->name : "<top>";
+}
+
+void dumpProfile(std::ostream& out, size_t topCallers)
+{
+    std::vector<std::pair<ProcCmd*, ProcProfile*> > sorted;
+    long long total = 0;
+    for (size_t id = 1; id < profiles.size(); id++)
+    {
+        if (!profiles[id].calls || !ProcCmd::table[id])
+            continue;
+        sorted.push_back(std::make_pair(ProcCmd::table[id], &profiles[id]));
+        total += profiles[id].exclusive;
+    }
+    std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) {
+        return a.second->exclusive != b.second->exclusive
+            ? a.second->exclusive > b.second->exclusive : a.first->name < b.first->name;
+    });
+
+    auto ms = [](long long ns) { return ns / 1e6; };
+    out << std::fixed << std::setprecision(3);
+    out << std::setw(12) << "calls" << std::setw(14) << "incl ms" << std::setw(14) << "excl ms"
+        << std::setw(8) << "excl%" << "  proc\n";
+    for (auto& [proc, p] : sorted)
+    {
+        out << std::setw(12) << p->calls << std::setw(14) << ms(p->inclusive) << std::setw(14) << ms(p->exclusive)
+            << std::setw(7) << std::setprecision(1) << (total ? 100.0 * p->exclusive / total : 0.0) << "%"
+            << std::setprecision(3) << "  " << proc->name << "\n";
+
+        std::vector<std::pair<ProcCmd*, long> > callers;
+        for (size_t id = 0; id < p->callers.size(); id++)
+            if (p->callers[id])
+                callers.push_back(std::make_pair(ProcCmd::table[id], p->callers[id]));
+        std::sort(callers.begin(), callers.end(), [](auto& a, auto& b) {
+            return a.second != b.second ? a.second > b.second : procName(a.first) < procName(b.first);
+        });
+        if (callers.size() > topCallers)
+            callers.resize(topCallers);
+        for (auto& [caller, count] : callers)
+            out << std::setw(48) << count << "  <- " << procName(caller) << "\n";
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef CPPORTH_PROFILER_H
+#define CPPORTH_PROFILER_H
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include "ast.h"
+
+// --profile: the interpreter and the IR VM bracket every proc call with
+// profileEnter and profileExit. Time between them is the call's inclusive
+// time; minus the time of the calls it makes, its exclusive time. Recursive
+// calls add to a proc's inclusive time only once, at the outermost activation.
+void profileEnter(ProcCmd *);
+void profileExit();
+// A tail call replaces the running proc; proc's caller is the proc it replaces.
+void profileTailCall(ProcCmd *);
+
+// Prints one row per called proc, by exclusive time, and its top callers.
+void dumpProfile(std::ostream&, size_t topCallers);
+
+// True when the interpreter has to make the calls above: under --profile,
+// --sample-hz or --trace.
+bool tracingCalls();
+
+// --heap-profile: every runtime allocation (alloc, memory, variants,
+// string literals, here) is recorded with its site: the Porth file and line
+// and the proc running it. Frees of untracked pointers are ignored.
+void heapAlloc(const void *, long size, const char *kind, const std::string& file, ProcCmd *, int line);
+void heapFree(const void *);
+// Prints peak live bytes per site and the allocations never freed, by site.
+void dumpHeapProfile(std::ostream&);
+
+// --trace: Chrome trace events, kept in memory until writeTrace. Load phases
+// are spans opened by a TraceScope; proc calls become spans when they take
+// at least --trace-min-us.
+class TraceScope
+{
+    std::string name;
+    long long start;
+public:
+    TraceScope(const std::string&);
+    ~TraceScope();
+};
+
+// Writes the buffered events as {"traceEvents": [...]}. Returns false if
+// path cannot be opened.
+bool writeTrace(const std::string& path);
+
+// --sample-hz: a SIGPROF timer samples the shadow call stack kept by
+// profileEnter/profileExit and sampleLine, the line of the expression being
+// run. The handler only copies into buffers allocated outside it: when it
+// has used up the spare one, it sets sampleNeedsBuffer and noteSampleLine
+// allocates the next.
+extern volatile int sampleLine;
+extern std::atomic<bool> sampleNeedsBuffer;
+void refillSamples();
+inline void noteSampleLine(int line)
+{
+    sampleLine = line;
+    if (sampleNeedsBuffer.load(std::memory_order_relaxed))
+        refillSamples();
+}
+void startSampling(long hz);
+// Stops the timer and prints one line per distinct stack in folded format
+// ("main;fib;fib:3 42"), innermost proc last with the sampled line, then
+// frees the samples.
+void dumpSamples(std::ostream&);
+
+#endif // CPPORTH_PROFILER_H
@@ -3,24 +3,57 @@
 #include "lexer.h"
 #include "parser.h"
 #include "syscalls.h"
+#include "args.h"
+#include "optimizer.h"
+#include "ir.h"
+#include "profiler.h"
+#include "memcheck.h"
+#include "native.h"
+#include "bytescan.h"
 #include <iostream>
 #include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Tells --heap-profile and --check-memory about a runtime allocation.
+static void noteAlloc(const void *p, long size, const char *kind, const std::string& file, ProcCmd *proc, int line)
+{
+    if (options.heapProfile)
+        heapAlloc(p, size, kind, file, proc, line);
+    if (options.checkMemory)
+        trackRegion(p, size, kind, line);
+}
+
+static void noteFree(const void *p)
+{
+    if (options.heapProfile)
+        heapFree(p);
+    if (options.checkMemory)
+        untrackRegion(p);
+}
 
 Env::Env(int argc, char** argv)
 {
-    variables.insert(std::make_pair("argc", Data(argc, TypeKind::INT)));
+    if (options.checkMemory)
+    {
+        trackRegion(argv, argc * sizeof(char*), "argv", 0);
+        for (int i = 0; i < argc; i++)
+            trackRegion(argv[i], std::strlen(argv[i]) + 1, "argv", 0);
+    }
+
+    variables.insert(std::make_pair(intern("argc"), Data(argc, TypeKind::INT)));
 
-    variables.insert(std::make_pair("argv", Data((long)argv, TypeKind::PTR)));
+    variables.insert(std::make_pair(intern("argv"), Data((long)argv, TypeKind::PTR)));
     filepath = argv[0];
     
 }
 
 Env::Env(const Env& other)
 {
-    variables = std::unordered_map<std::string, Data>(other.variables);
-    procs = std::unordered_map<std::string, ProcCmd*>(other.procs);
+    variables = std::unordered_map<Symbol, Data>(other.variables);
+    procs = std::unordered_map<Symbol, ProcCmd*>(other.procs);
     included = std::vector<std::string>(other.included);
-    types = std::unordered_map<std::string, TypeCmd*>(other.types);
+    types = std::unordered_map<Symbol, TypeCmd*>(other.types);
     strings = std::unordered_map<std::string, char*>(other.strings);
     offset = other.offset;
     filepath = other.filepath;
@@ -31,15 +64,33 @@ Env::Env() {;}
 
 bool Env::containsKey(std::string key)
 {
-    return (variables.find(key) != variables.end() || procs.find(key) != procs.end());
+    return isVariable(key) || isProc(key);
 }
 
+// The string overloads look names up without interning them, so queries for
+// names that were never defined do not grow the symbol table.
 Data Env::getVar(std::string key)
+{
+    Symbol sym;
+    if (!findSymbol(key, sym))
+        throw std::out_of_range(key);
+    return getVar(sym);
+}
+
+Data Env::getVar(Symbol key)
 {
     return variables.at(key);
 }
 
 ProcCmd *Env::getProc(std::string key)
+{
+    Symbol sym;
+    if (!findSymbol(key, sym))
+        throw std::out_of_range(key);
+    return getProc(sym);
+}
+
+ProcCmd *Env::getProc(Symbol key)
 {
     return procs.at(key);
 }
@@ -47,7 +98,10 @@ ProcCmd *Env::getProc(std::string key)
 Env::~Env()
 {
     for (auto a : toClean)
+    {
+        noteFree(a);
         delete[] a;
+    }
 }
 
 Env& Env::operator=(Env other)
@@ -88,11 +142,23 @@ bool Env::isIncluded(std::string n)
 }
 
 bool Env::isProc(std::string n)
+{
+    Symbol sym;
+    return findSymbol(n, sym) && isProc(sym);
+}
+
+bool Env::isProc(Symbol n)
 {
     return procs.find(n) != procs.end();
 }
 
 bool Env::isVariable(std::string n)
+{
+    Symbol sym;
+    return findSymbol(n, sym) && isVariable(sym);
+}
+
+bool Env::isVariable(Symbol n)
 {
     return variables.find(n) != variables.end();
 }
@@ -198,9 +264,9 @@ bool Stack::isEmpty()
 
 void Stack::assertMinSize(int s, int line)
 {
-    if (data.size() < s)
+    if (data.size() < (size_t)s)
     {
-        std::cout << "Error:" << line << ": operation requires at least " << s << " items\n";
+        std::cout << "Error:" << line << ": operation requires at least " << s << " items" << std::endl;
         throw new std::exception();
     }
 }
@@ -250,6 +316,48 @@ Data Stack::pop()
     return l;
 }
 
+// Shuffles work on the cells in place instead of popping and pushing.
+
+void Stack::swap(int line)
+{
+    assertMinSize(2, line);
+    std::swap(data[data.size()-1], data[data.size()-2]);
+}
+
+void Stack::rot(int line)
+{
+    assertMinSize(3, line);
+    auto n = data.size();
+    Data a = data[n-3];
+    data[n-3] = data[n-2];
+    data[n-2] = data[n-1];
+    data[n-1] = a;
+}
+
+void Stack::over(int line)
+{
+    assertMinSize(2, line);
+    data.push_back(data[data.size()-2]);
+}
+
+// Unchecked; callers assertMinSize first.
+Data& Stack::cell(int depth)
+{
+    return data[data.size()-1-depth];
+}
+
+void Stack::permute(int depth, const std::vector<int>& order, int line)
+{
+    assertMinSize(depth, line);
+    Data window[PermuteExpr::MAX_DEPTH];
+    size_t base = data.size() - depth;
+    for (int i = 0; i < depth; i++)
+        window[i] = data[base + i];
+    data.resize(base);
+    for (int i : order)
+        data.push_back(window[i]);
+}
+
 int Stack::size()
 {
     return data.size();
@@ -265,14 +373,15 @@ std::vector<AST*> toAstVec(std::vector<Expr*> exprs)
     return res;
 }
 
-VariantData::VariantData(std::string name, std::string parent, std::vector<Data> data) :
-    name(name), parent(parent), values(data) {;}
+VariantData::VariantData(Symbol name, std::vector<Data> data) :
+    name(name), values(data) {;}
 
 void include(std::string path, Env& env)
 {
+    TraceScope trace("include " + path);
     std::string contents = openFile(path);
     Lexer lexer(contents);
-    Parser parser(lexer.lex());
+    Parser parser(lexer.lex(), options.lazyProcs);
 
     std::vector<AST*> prog = parser.parse();
 
@@ -281,16 +390,22 @@ void include(std::string path, Env& env)
         switch (ast->getASTKind())
         {
             case ASTKind::PROCCMD:
-                env.procs.insert(std::make_pair(((ProcCmd *)ast)->name, (ProcCmd *)ast));
+                ((ProcCmd *)ast)->file = env.filepath;
+                env.procs.insert(std::make_pair(intern(((ProcCmd *)ast)->name), (ProcCmd *)ast));
+                if (!((ProcCmd *)ast)->library.empty())
+                    bindExtern((ProcCmd *)ast);
+                else
+                    bindNative((ProcCmd *)ast);
                 break;
             case ASTKind::CONSTCMD:
             {
                 Stack s;
                 ConstCmd *c = (ConstCmd *)ast;
+                TraceScope trace("const " + c->ident);
                 long offs = (long)env.offset;
                 auto res = interpExpr(c->body, s, env);
                 Data d((!res.isNone() ? res.getValue() : 0) + offs, res.getType());
-                env.variables.insert(std::make_pair(c->ident, d));
+                env.variables.insert(std::make_pair(intern(c->ident), d));
                 break;
             }
 
@@ -317,13 +432,15 @@ void include(std::string path, Env& env)
                 Stack s;
                 long size = interpExpr(memcmd->body, s, env).getValue();
                 unsigned char *m = new unsigned char[size]();
-                env.variables.insert(std::make_pair(memcmd->ident, Data((long)m, TypeKind::PTR)));
+                env.variables.insert(std::make_pair(intern(memcmd->ident), Data((long)m, TypeKind::PTR)));
+                globalMemory().push_back(MemoryRegion{memcmd->ident, (long)m, size});
+                noteAlloc(m, size, "memory", env.filepath, nullptr, memcmd->line);
                 break;
             }
             case ASTKind::TYPECMD:
             {
                 auto type = (TypeCmd*)ast;
-                env.types.insert(std::make_pair(type->name, type));
+                env.types.insert(std::make_pair(intern(type->name), type));
                 break;
             }
             case ASTKind::ASSERTCMD:
@@ -345,9 +462,98 @@ void include(std::string path, Env& env)
     }
 }
 
+bool compare(OpKind kind, long lhs, long rhs)
+{
+    switch (kind)
+    {
+        case OpKind::LT: return lhs < rhs;
+        case OpKind::GT: return lhs > rhs;
+        case OpKind::LE: return lhs <= rhs;
+        case OpKind::GE: return lhs >= rhs;
+        case OpKind::EQ: return lhs == rhs;
+        case OpKind::NE: return lhs != rhs;
+        default: return false;
+    }
+}
+
+// ngrams
+
+static std::unordered_map<std::string, long> bigrams;
+static std::unordered_map<std::string, long> trigrams;
+
+static std::string ngramLabel(Expr *exp)
+{
+    switch (exp->getASTKind())
+    {
+        case ASTKind::INTEXPR: return std::to_string(((IntExpr *)exp)->getValue());
+        case ASTKind::IMMEXPR: return std::to_string(((ImmExpr *)exp)->value);
+        case ASTKind::CHAREXPR: return std::to_string(((CharExpr *)exp)->getValue());
+        case ASTKind::STRINGLITEXPR: return "\"...\"";
+        case ASTKind::TRUEEXPR: return "true";
+        case ASTKind::FALSEEXPR: return "false";
+        case ASTKind::OPEXPR: return ((OpExpr *)exp)->op;
+        case ASTKind::VAREXPR: return symbolName(((VarExpr *)exp)->sym);
+        case ASTKind::WHILEEXPR: return "while";
+        case ASTKind::IFEXPR: return "if";
+        case ASTKind::LETSTMT: return "let";
+        case ASTKind::PEEKSTMT: return "peek";
+        case ASTKind::MATCHSTMT: return "match";
+        case ASTKind::PRINTEXPR: return "print";
+        case ASTKind::SWAPEXPR: return "swap";
+        case ASTKind::DROPEXPR: return "drop";
+        case ASTKind::DUPEXPR: return "dup";
+        case ASTKind::OVEREXPR: return "over";
+        case ASTKind::ROTEXPR: return "rot";
+        case ASTKind::SYSCALLEXPR: return "syscall" + std::to_string(((SyscallExpr *)exp)->getNumArgs());
+        case ASTKind::ADDROFEXPR: return "addr-of";
+        case ASTKind::CALLLIKEEXPR: return "call-like";
+        case ASTKind::SCANEXPR: return ((ScanExpr *)exp)->name();
+        default: return exp->toString();
+    }
+}
+
+// recent holds the labels of the previous (up to two) words in the same body.
+static void countNgrams(Expr *exp, std::vector<std::string>& recent)
+{
+    auto label = ngramLabel(exp);
+    if (recent.size() >= 1)
+        bigrams[recent.back() + " " + label]++;
+    if (recent.size() >= 2)
+        trigrams[recent[0] + " " + recent[1] + " " + label]++;
+    if (recent.size() == 2)
+        recent.erase(recent.begin());
+    recent.push_back(label);
+}
+
+static void dumpTable(std::ostream& out, const std::unordered_map<std::string, long>& counts, size_t top)
+{
+    std::vector<std::pair<std::string, long> > sorted(counts.begin(), counts.end());
+    std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    if (sorted.size() > top)
+        sorted.resize(top);
+    for (auto& [gram, count] : sorted)
+        out << "  " << count << "\t" << gram << "\n";
+}
+
+void dumpNgrams(std::ostream& out, size_t top)
+{
+    out << "2-grams:\n";
+    dumpTable(out, bigrams, top);
+    out << "3-grams:\n";
+    dumpTable(out, trigrams, top);
+}
+
 // interp
 
-Data interp(std::vector<AST*> prog, Stack& stack, Env& env)
+std::vector<MemoryRegion>& globalMemory()
+{
+    static std::vector<MemoryRegion> regions;
+    return regions;
+}
+
+void load(std::vector<AST*> prog, Env& env)
 {
     for (auto ast : prog)
     {
@@ -355,16 +561,20 @@ Data interp(std::vector<AST*> prog, Stack& stack, Env& env)
         switch (ast->getASTKind())
         {
             case ASTKind::PROCCMD:
-                env.procs.insert(std::make_pair(((ProcCmd *)ast)->name, (ProcCmd *)ast));
+                ((ProcCmd *)ast)->file = env.filepath;
+                env.procs.insert(std::make_pair(intern(((ProcCmd *)ast)->name), (ProcCmd *)ast));
+                if (!((ProcCmd *)ast)->library.empty())
+                    bindExtern((ProcCmd *)ast);
                 break;
             case ASTKind::CONSTCMD:
             {
                 Stack s;
                 ConstCmd *c = (ConstCmd *)ast;
+                TraceScope trace("const " + c->ident);
                 long offs = (long)env.offset;
                 auto res = interpExpr(c->body, s, env);
                 Data d((!res.isNone() ? res.getValue() : 0) + offs, res.getType());
-                env.variables.insert(std::make_pair(c->ident, d));
+                env.variables.insert(std::make_pair(intern(c->ident), d));
                 break;
             }
             case ASTKind::INCLUDECMD:
@@ -386,7 +596,7 @@ Data interp(std::vector<AST*> prog, Stack& stack, Env& env)
             case ASTKind::TYPECMD:
             {
                 auto type = (TypeCmd*)ast;
-                env.types.insert(std::make_pair(type->name, type));
+                env.types.insert(std::make_pair(intern(type->name), type));
                 break;
             }
             case ASTKind::MEMORYCMD:
@@ -395,7 +605,9 @@ Data interp(std::vector<AST*> prog, Stack& stack, Env& env)
                 Stack s;
                 long size = interpExpr(memcmd->body, s, env).getValue();
                 unsigned char *m = new unsigned char[size]();
-                env.variables.insert(std::make_pair(memcmd->ident, Data((long)m, TypeKind::PTR)));
+                env.variables.insert(std::make_pair(intern(memcmd->ident), Data((long)m, TypeKind::PTR)));
+                globalMemory().push_back(MemoryRegion{memcmd->ident, (long)m, size});
+                noteAlloc(m, size, "memory", env.filepath, nullptr, memcmd->line);
                 break;
             }
             case ASTKind::ASSERTCMD:
@@ -416,20 +628,373 @@ Data interp(std::vector<AST*> prog, Stack& stack, Env& env)
         }
     }
 
-    if (env.procs.find("main") == env.procs.end())
+    if (!env.isProc("main"))
     {
         std::cout << "Error: Main function not found.\n";
         throw new std::exception();
     }
 
-    return interpExpr(env.procs.at("main")->body, stack, env);
+    TraceScope trace("optimize");
+    optimize(env, prog);
+}
+
+// --tiered: procs lower against the globals as they were before main ran,
+// like lowerProcs under --ir, not against bindings made since.
+static std::unique_ptr<Env> tierEnv;
+static ProcCmd *tierMain = nullptr;
+
+Data interp(std::vector<AST*> prog, Stack& stack, Env& env)
+{
+    load(prog, env);
+
+    auto main = env.getProc("main");
+    if (tracingCalls())
+        profileEnter(main);
+    if (main->ir)
+        runIR(main->ir.get(), stack);
+    else
+    {
+        if (options.tiered)
+        {
+            tierEnv = std::make_unique<Env>(env);
+            tierMain = main;
+        }
+        interpExpr(main->getBody(), stack, env, main);
+    }
+    if (tracingCalls())
+        profileExit();
+    return stack.top();
+}
+
+// frames
+
+Frame Frame::block(const std::vector<Expr*>& exps)
+{
+    Frame f;
+    f.kind = FrameKind::BLOCK;
+    f.ip = exps.data();
+    f.end = exps.data() + exps.size();
+    return f;
+}
+
+// A one-expression block, used to run an if* after its else.
+Frame Frame::single(Expr *const *exp)
+{
+    Frame f;
+    f.kind = FrameKind::BLOCK;
+    f.ip = exp;
+    f.end = exp + 1;
+    return f;
+}
+
+Frame Frame::loop(WhileExpr *w)
+{
+    Frame f;
+    f.kind = FrameKind::WHILE_COND;
+    f.w = w;
+    return f;
+}
+
+Frame Frame::scope(const std::vector<Symbol> *idents)
+{
+    Frame f;
+    f.kind = FrameKind::SCOPE;
+    f.idents = idents;
+    return f;
+}
+
+// Nothing is left to run between the current expression and the end of the
+// innermost proc: every block up to its PROC frame is finished.
+static bool inTailPosition(const std::vector<Frame>& frames)
+{
+    for (int i = frames.size()-1; i >= 0; i--)
+    {
+        if (frames[i].kind == FrameKind::PROC)
+            return true;
+        if (frames[i].kind != FrameKind::BLOCK || frames[i].ip != frames[i].end)
+            return false;
+    }
+    return false;
+}
+
+static Env *innermostEnv(std::vector<Frame>& frames, Env& root)
+{
+    for (int i = frames.size()-1; i >= 0; i--)
+        if (frames[i].kind == FrameKind::PROC)
+            return frames[i].env.get();
+    return &root;
+}
+
+static ProcCmd *innermostProc(std::vector<Frame>& frames, ProcCmd *root)
+{
+    for (int i = frames.size()-1; i >= 0; i--)
+        if (frames[i].kind == FrameKind::PROC)
+            return frames[i].proc;
+    return root;
+}
+
+// --tiered: promotes proc (and the procs it calls) to the IR tier once its
+// calls plus loop back-edges reach --tier-threshold.
+static void countCall(ProcCmd *proc)
+{
+    if (++proc->calls + proc->backEdges < options.tierThreshold || !tierEnv)
+        return;
+    bool ok = tierUp(proc, *tierEnv, options.dumpIR ? &std::cerr : nullptr);
+    if (options.verbose)
+        std::cerr << "[tier] proc " << proc->name << (ok ? ": promoted to IR" : ": stays interpreted")
+            << " after " << proc->calls << " calls, " << proc->backEdges << " back-edges" << std::endl;
+}
+
+// --tiered: counts a run of w's condition in proc. Once a loop in main runs
+// --tier-threshold times it is replaced on the stack: the rest of it runs
+// as IR, lowered against the bindings in scope. Returns true if it did.
+// A loop that bakes in only globals is kept on w and reused as soon as it
+// is entered again at the same stack depth.
+static bool countLoop(WhileExpr *w, ProcCmd *proc, Stack& stack, Env& env)
+{
+    static const int MAX_OSR_DEPTH = 64;
+
+    if (w->osr && w->osrDepth == stack.size())
+    {
+        runIR(w->osr.get(), stack);
+        return true;
+    }
+
+    proc->backEdges++;
+    if (proc != tierMain || w->noOSR || ++w->backEdges < options.tierThreshold)
+        return false;
+    w->backEdges = 0;
+
+    std::shared_ptr<IRFunc> fn;
+    std::vector<Symbol> baked;
+    if (stack.size() <= MAX_OSR_DEPTH)
+        fn = lowerLoop(w, proc, env, stack.size(), options.dumpIR ? &std::cerr : nullptr, &baked);
+    if (fn && std::all_of(baked.begin(), baked.end(), [&](Symbol s) {
+            auto global = tierEnv->variables.find(s);
+            return global != tierEnv->variables.end() && global->second.getValue() == env.variables.at(s).getValue()
+                && global->second.getType() == env.variables.at(s).getType();
+        }))
+    {
+        w->osr = fn;
+        w->osrDepth = stack.size();
+    }
+    if (options.verbose)
+        std::cerr << "[tier] " << proc->name << ":" << w->line << ": while loop "
+            << (fn ? "replaced by IR" : "stays interpreted") << " after "
+            << options.tierThreshold << " iterations" << std::endl;
+    if (!fn)
+    {
+        w->noOSR = true;
+        return false;
+    }
+    runIR(fn.get(), stack);
+    return true;
 }
 
-Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
+// Calls reuse the caller's PROC frame and Env when they are in tail position;
+// the caller's Env would be discarded on return anyway. Procs lowered by
+// --ir or --tiered run to completion on the IR VM.
+static void callProc(std::vector<Frame>& frames, ProcCmd *proc, Env*& cur, ProcCmd*& curProc, Stack& stack)
 {
-    for (auto exp : exps)
+    if (proc->native || proc->thunk)
     {
+        if (tracingCalls())
+            profileEnter(proc);
+        if (proc->native)
+            proc->native(stack);
+        else
+            proc->thunk(stack, proc->symbol);
+        if (tracingCalls())
+            profileExit();
+        return;
+    }
+
+    if (options.tiered && !proc->ir && !proc->tierFailed)
+        countCall(proc);
+
+    if (proc->ir)
+    {
+        if (tracingCalls())
+            profileEnter(proc);
+        runIR(proc->ir.get(), stack);
+        if (tracingCalls())
+            profileExit();
+        return;
+    }
+
+    auto& body = proc->getBody();
+    if (inTailPosition(frames))
+    {
+        if (tracingCalls())
+            profileTailCall(proc);
+        while (frames.back().kind == FrameKind::BLOCK)
+            frames.pop_back();
+        frames.back().proc = proc;
+        curProc = proc;
+        frames.push_back(Frame::block(body));
+        return;
+    }
+
+    Frame f;
+    f.kind = FrameKind::PROC;
+    f.env = std::make_unique<Env>(*cur);
+    f.proc = proc;
+    cur = f.env.get();
+    curProc = proc;
+    if (tracingCalls())
+        profileEnter(proc);
+    frames.push_back(std::move(f));
+    frames.push_back(Frame::block(body));
+}
+
+// Pops the while condition's result; true if the body should run.
+static bool loopTest(WhileExpr *w, Stack& stack)
+{
+    if (w->cmp != OpKind::UNKNOWN)
+    {
+        auto rhs = stack.pop();
+        auto lhs = stack.pop();
+        return compare(w->cmp, lhs.getValue(), rhs.getValue());
+    }
+    auto r = stack.pop();
+    if (r.isTrue())
+        return true;
+    if (r.isFalse())
+        return false;
+    std::cout << "Error:" << w->line << ": Expected bool, got " << Type(r.getType()).toString() << std::endl;
+    throw new std::exception();
+}
+
+// --heap-profile sites are in the running proc's file; top-level code is in env's.
+static const std::string& siteFile(ProcCmd *proc, Env& env)
+{
+    return proc ? proc->file : env.filepath;
+}
+
+// op stats
+
+static long kindCounts[(int)ASTKind::SUPEREXPR + 1];
+static long opCounts[(int)OpKind::UNKNOWN + 1];
+static std::unordered_map<long, long> lineCounts;   // (proc id << 32 | line) -> count
+
+static void countOp(Expr *exp, ProcCmd *proc)
+{
+    kindCounts[(int)exp->getASTKind()]++;
+    if (exp->getASTKind() == ASTKind::OPEXPR)
+        opCounts[(int)((OpExpr *)exp)->kind]++;
+    lineCounts[(proc ? proc->id << 32 : 0) | (unsigned)exp->line]++;
+}
+
+static const char *kindName(ASTKind kind)
+{
+    static const char *names[] = {
+        "int", "true", "false", "op", "var", "while", "if", "proc", "const",
+        "memory", "include", "char", "string", "let", "peek", "print",
+        "local memory", "offset", "reset", "swap", "drop", "dup", "over", "rot",
+        "here", "syscall", "max", "assert", "addr-of", "assert", "call-like",
+        "alloc", "free", "type", "match", "new", "variant binding", "array",
+        "immediate", "permute", "scan", "super"
+    };
+    static_assert(sizeof(names) / sizeof(*names) == (int)ASTKind::SUPEREXPR + 1);
+    return names[(int)kind];
+}
+
+void dumpOpStats(std::ostream& out, size_t top)
+{
+    std::unordered_map<std::string, long> kinds, ops, lines;
+    for (int i = 0; i <= (int)ASTKind::SUPEREXPR; i++)
+        if (kindCounts[i])
+            kinds[kindName((ASTKind)i)] += kindCounts[i];
+    for (int i = 0; i < (int)OpKind::UNKNOWN; i++)
+        if (opCounts[i])
+            ops[opName((OpKind)i)] = opCounts[i];
+    for (auto& [key, count] : lineCounts)
+    {
+        long id = key >> 32;
+        auto proc = id > 0 && id < ProcCmd::table.size() ? ProcCmd::table[id] : nullptr;
+        lines[(proc ? proc->name : "<top>") + ":" + std::to_string(key & 0xFFFFFFFF)] = count;
+    }
+
+    out << "by kind:\n";
+    dumpTable(out, kinds, kinds.size());
+    out << "by op:\n";
+    dumpTable(out, ops, ops.size());
+    out << "hottest lines:\n";
+    dumpTable(out, lines, top);
+}
+
+// The dispatch loop, instantiated with OpStats for --op-stats so the
+// counting compiles away otherwise.
+template <bool OpStats>
+static Data interpLoop(const std::vector<Expr*>& exps, Stack& stack, Env& root, ProcCmd *rootProc)
+{
+    std::vector<Frame> frames;
+    frames.push_back(Frame::block(exps));
+    Env *cur = &root;
+    ProcCmd *curProc = rootProc;
+
+    while (!frames.empty())
+    {
+        switch (frames.back().kind)
+        {
+            case FrameKind::BLOCK:
+                if (frames.back().ip != frames.back().end)
+                    break;
+                frames.pop_back();
+                continue;
+
+            case FrameKind::WHILE_COND:
+            {
+                auto w = frames.back().w;
+                if (options.tiered && curProc && countLoop(w, curProc, stack, *cur))
+                {
+                    frames.pop_back();
+                    continue;
+                }
+                frames.back().kind = FrameKind::WHILE_BODY;
+                frames.push_back(Frame::block(w->cond));
+                continue;
+            }
+
+            case FrameKind::WHILE_BODY:
+            {
+                auto w = frames.back().w;
+                if (!loopTest(w, stack))
+                {
+                    frames.pop_back();
+                    continue;
+                }
+                frames.back().kind = FrameKind::WHILE_COND;
+                frames.push_back(Frame::block(w->body));
+                continue;
+            }
+
+            case FrameKind::SCOPE:
+                for (auto& ident : *frames.back().idents)
+                    cur->variables.erase(ident);
+                frames.pop_back();
+                continue;
+
+            case FrameKind::PROC:
+                if (tracingCalls())
+                    profileExit();
+                frames.pop_back();
+                cur = innermostEnv(frames, root);
+                curProc = innermostProc(frames, rootProc);
+                continue;
+        }
+
+        Env& env = *cur;
+        Frame& frame = frames.back();
+        Expr *exp = *frame.ip++;
+
         //std::cout << stack.toString() << " " << exp->toString() << std::endl;
+        if (options.ngrams)
+            countNgrams(exp, frame.recent);
+        if constexpr (OpStats)
+            countOp(exp, curProc);
+        if (options.sampleHz)
+            noteSampleLine(exp->line);
 
         switch (exp->getASTKind())
         {
@@ -440,12 +1005,20 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
                 break;
             }
 
+            case ASTKind::IMMEXPR:
+            {
+                auto i = (ImmExpr *)exp;
+                stack.push(Data(i->value, i->type));
+                break;
+            }
+
             case ASTKind::ALLOCSTMT:
             {
                 auto a = (AllocExpr *)exp;
                 long size = stack.pop().getValue();
                 unsigned char *m = new unsigned char[size]();
                 stack.push(m);
+                noteAlloc(m, size, "alloc", siteFile(curProc, env), curProc, exp->line);
                 break;
             }
 
@@ -454,17 +1027,15 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
                 auto m = (MatchExpr *)exp;
                 VariantData *v = (VariantData *)stack.pop().getValue();
 
-                auto branch = m->branches.find(v->name) != m->branches.end() ? 
-                    m->branches.at(v->name) : m->branches.at("else");
+                static const Symbol elseSym = intern("else");
+                auto it = m->branches.find(v->name);
+                auto branch = it != m->branches.end() ? it->second : m->branches.at(elseSym);
 
                 for (int i = 0; i < branch->idents.size(); i++)
                     env.variables.insert(std::make_pair(branch->idents[i], v->values[i]));
                 
-                interpExpr(branch->body, stack, env);
-
-                for (auto ident : branch->idents)
-                    env.variables.erase(ident);
-
+                frames.push_back(Frame::scope(&branch->idents));
+                frames.push_back(Frame::block(branch->body));
                 break;
             }
 
@@ -480,8 +1051,10 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
                     s.clear();
                 }
 
-                auto res = new VariantData(n->variant, n->parent, data);
+                auto res = new VariantData(n->variantSym, data);
                 stack.push(res);
+                noteAlloc(res, sizeof(VariantData) + data.size() * sizeof(Data), "variant",
+                    siteFile(curProc, env), curProc, exp->line);
 
                 break;
             }
@@ -490,24 +1063,60 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
             {
                 auto top = stack.pop();
                 auto ptr = (unsigned char *)top.getValue();
+                noteFree(ptr);
                 delete[] ptr;
                 break;
             }
 
+            case ASTKind::SCANEXPR:
+            {
+                auto sc = (ScanExpr *)exp;
+                long res;
+                if (sc->kind == ScanKind::MEMCMP)
+                {
+                    long b = stack.pop().getValue(), a = stack.pop().getValue(), n = stack.pop().getValue();
+                    if (options.checkMemory)
+                    {
+                        checkSpan(a, n, "memcmp", exp->line);
+                        checkSpan(b, n, "memcmp", exp->line);
+                    }
+                    res = scanMemcmp((unsigned char *)a, (unsigned char *)b, n);
+                }
+                else if (sc->kind == ScanKind::FINDBYTESET)
+                {
+                    long set = stack.pop().getValue(), setn = stack.pop().getValue();
+                    long s = stack.pop().getValue(), n = stack.pop().getValue();
+                    if (options.checkMemory)
+                    {
+                        checkSpan(s, n, "find-byte-set", exp->line);
+                        checkSpan(set, setn, "find-byte-set", exp->line);
+                    }
+                    res = scanFindByteSet((unsigned char *)s, n, (unsigned char *)set, setn);
+                }
+                else
+                {
+                    long byte = stack.pop().getValue(), s = stack.pop().getValue(), n = stack.pop().getValue();
+                    if (options.checkMemory)
+                        checkSpan(s, n, sc->kind == ScanKind::MEMCHR ? "memchr" : "count-byte", exp->line);
+                    res = sc->kind == ScanKind::MEMCHR ? scanMemchr((unsigned char *)s, n, byte)
+                        : scanCountByte((unsigned char *)s, n, byte);
+                }
+                stack.push(res);
+                break;
+            }
+
             case ASTKind::VAREXPR:
             {
                 VarExpr *v = (VarExpr *)exp;
                 
-                if (env.procs.find(v->name) != env.procs.end())
-                {
-                    Env e2(env);
-                    interpExpr(env.procs.at(v->name)->body, stack, e2);
-                }
-                else if (env.variables.find(v->name) != env.variables.end())
-                    stack.push(env.variables.at(v->name));
+                auto proc = env.procs.find(v->sym);
+                if (proc != env.procs.end())
+                    callProc(frames, proc->second, cur, curProc, stack);
+                else if (auto var = env.variables.find(v->sym); var != env.variables.end())
+                    stack.push(var->second);
                 else
                 {
-                    std::cout << "RuntimeError:" << exp->line << ": Unknown identifier encountered: '" << v->name << "'\n";
+                    std::cout << "RuntimeError:" << exp->line << ": Unknown identifier encountered: '" << symbolName(v->sym) << "'\n";
                     throw new std::exception();
                 }
                 break;
@@ -518,66 +1127,45 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
                 auto a = (AddrOfExpr *)exp;
                 auto v = a->proc;
 
-                if (env.procs.find(v->name) == env.procs.end())
+                if (!a->target)
                 {
-                    std::cout << "RuntimeError:" << exp->line << ": addr-of: procedure does not exist: '" << v->name << "'\n";
-                    throw new std::exception();
+                    auto proc = env.procs.find(v->sym);
+                    if (proc == env.procs.end())
+                    {
+                        std::cout << "RuntimeError:" << exp->line << ": addr-of: procedure does not exist: '" << symbolName(v->sym) << "'\n";
+                        throw new std::exception();
+                    }
+                    a->target = proc->second;
                 }
-                
-                auto ptr = new char[v->name.length()+1];
-                std::strncpy(ptr, v->name.c_str(), v->name.length()+1);
-                env.toClean.push_back((unsigned char *)ptr);
-
-                stack.push(Data((long)ptr, TypeKind::ADDR));
 
+                stack.push(Data(a->target->id, TypeKind::ADDR));
                 break;
             }
 
             case ASTKind::CALLLIKEEXPR:
             {
                 auto c = (CallLikeExpr *)exp;
-                auto addr = stack.pop();
-                auto v = std::string((char *)addr.getValue());
+                long id = stack.pop().getValue();
 
-
-                if (env.procs.find(v) == env.procs.end())
-                {
-                    std::cout << "RuntimeError:" << exp->line << ": call-like: addr is invalid: '" << v << "'\n";
-                    throw new std::exception();
-                }
-
-                auto proc = env.procs.at(v);
-
-
-                Env e2(env);
-                interpExpr(proc->body, stack, e2);
-
-                break;
-            }
-
-            case ASTKind::WHILEEXPR:
-            {
-                WhileExpr *w = (WhileExpr *)exp;
-                
-                while (1) 
+                if (id != c->cachedId)
                 {
-                    interpExpr(w->cond, stack, env);
-                    auto r = stack.pop();
-                    if (r.isTrue())
-                        interpExpr(w->body, stack, env);
-                    else if (r.isFalse())
-                        break;
-                    else
+                    if (id <= 0 || id >= ProcCmd::table.size() || !ProcCmd::table[id])
                     {
-                        std::cout << "Error:" << exp->line << ": Expected bool, got " << Type(r.getType()).toString() << std::endl;
+                        std::cout << "RuntimeError:" << exp->line << ": call-like: addr is invalid: '" << id << "'\n";
                         throw new std::exception();
                     }
+                    c->cachedId = id;
+                    c->cached = ProcCmd::table[id];
                 }
-                
 
+                callProc(frames, c->cached, cur, curProc, stack);
                 break;
             }
 
+            case ASTKind::WHILEEXPR:
+                frames.push_back(Frame::loop((WhileExpr *)exp));
+                break;
+
             case ASTKind::STRINGLITEXPR:
             {
                 StringLitExpr *s = (StringLitExpr *)exp;
@@ -595,6 +1183,7 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
 
                 char *ptr = new char[len];
                 std::strncpy(ptr, str.data(), len);
+                noteAlloc(ptr, len, "string", siteFile(curProc, env), curProc, exp->line);
                 stack.push(ptr);
                 env.strings.insert(std::make_pair(str, ptr));
                 break;
@@ -637,7 +1226,7 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
                 for (int i = 0; i < e->getNumArgs(); i++)
                     args.push_back(stack.pop().getValue());
                 
-                stack.push(syscall(sysnum, args));
+                stack.push(syscall(sysnum, args, e->resultUsed));
                 break;
             }
 
@@ -647,8 +1236,9 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
                 Stack sta;
                 auto s = interpExpr(ex->body, sta, env);                
                 auto ptr = new unsigned char[s.getValue()];
-                env.variables.insert(std::make_pair(ex->getIdent(), Data((long)ptr, TypeKind::PTR)));
+                env.variables.insert(std::make_pair(ex->sym, Data((long)ptr, TypeKind::PTR)));
                 env.toClean.push_back(ptr);
+                noteAlloc(ptr, s.getValue(), "local memory", siteFile(curProc, env), curProc, exp->line);
                 break;
             }
 
@@ -656,18 +1246,23 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
             {
                 auto f = (IfExpr *)exp;
 
-                if (stack.pop().isTrue()) 
+                bool taken;
+                if (f->cmp != OpKind::UNKNOWN)
                 {
-                    interpExpr(f->then, stack, env);
-                    break;
+                    auto rhs = stack.pop();
+                    auto lhs = stack.pop();
+                    taken = compare(f->cmp, lhs.getValue(), rhs.getValue());
                 }
-                else if (f->elze.size() != 0)
-                    interpExpr(f->elze, stack, env);
+                else
+                    taken = stack.pop().isTrue();
 
-                if (f->next && f->elze.size() > 0)
+                if (taken)
+                    frames.push_back(Frame::block(f->then));
+                else if (f->elze.size() != 0)
                 {
-                    std::vector<Expr*> expr = {f->next};
-                    interpExpr(expr, stack, env);
+                    if (f->next)
+                        frames.push_back(Frame::single((Expr *const *)&f->next));
+                    frames.push_back(Frame::block(f->elze));
                 }
             
                 break;
@@ -675,18 +1270,17 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
 
             case ASTKind::LETSTMT:
             {
+                static const Symbol underscore = intern("_");
                 auto let = (LetExpr *)exp;
                 //stack.assertMinSize(let->idents.size(), let->line);
                 for (int i = let->idents.size()-1; i >= 0; i--)
-                    if (let->idents[i] == "_")
+                    if (let->idents[i] == underscore)
                         stack.pop();
                     else
                         env.variables.insert(std::make_pair(let->idents[i], stack.pop()));
                 
-                interpExpr(let->body, stack, env);
-
-                for (auto ident : let->idents)
-                    env.variables.erase(ident);
+                frames.push_back(Frame::scope(&let->idents));
+                frames.push_back(Frame::block(let->body));
 
                 break;
             }
@@ -702,10 +1296,8 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
                         std::make_pair(peek->idents[i], data[size-(peek->idents.size()-i)])
                     );
                 
-                interpExpr(peek->body, stack, env);
-
-                for (auto ident : peek->idents)
-                    env.variables.erase(ident);
+                frames.push_back(Frame::scope(&peek->idents));
+                frames.push_back(Frame::block(peek->body));
 
                 break;
             }
@@ -714,294 +1306,206 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
             {
                 auto op = (OpExpr *)exp;
 
-                // ARITHMETIC
-                
-                if (op->op == "+")
+                switch (op->kind)
                 {
-                    //stack.assertMinSize(2, op->line);
-                    auto rhs = stack.pop();
-                    auto lhs = stack.pop();
-                    //rhs.assertType(TypeKind::INT, op->line);
-                    //lhs.assertType(TypeKind::INT, op->line);
-                    stack.push(lhs.getValue() + rhs.getValue());
-                }
+                    // ARITHMETIC
 
-                else if (op->op == "-")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto rhs = stack.pop();
-                    auto lhs = stack.pop();
-                    //rhs.assertType(TypeKind::INT, op->line);
-                    //lhs.assertType(TypeKind::INT, op->line);
-                    stack.push(lhs.getValue() - rhs.getValue());
-                }
-
-                else if (op->op == "*")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto rhs = stack.pop();
-                    auto lhs = stack.pop();
-                    //rhs.assertType(TypeKind::INT, op->line);
-                    //lhs.assertType(TypeKind::INT, op->line);
-                    stack.push(lhs.getValue() * rhs.getValue());
-                }
-
-                else if (op->op == "divmod")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto rhs = stack.pop();
-                    auto lhs = stack.pop();
-                    //rhs.assertType(TypeKind::INT, op->line);
-                    //lhs.assertType(TypeKind::INT, op->line);
-                    stack.push(lhs.getValue() / rhs.getValue());
-                    stack.push(lhs.getValue() % rhs.getValue());
-                }
-
-                // COMPARISON
-
-                else if (op->op == "<")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto rhs = stack.pop();
-                    auto lhs = stack.pop();
-                    //rhs.assertType(TypeKind::INT, op->line);
-                    //lhs.assertType(TypeKind::INT, op->line);
-                    if (lhs.getValue() < rhs.getValue())
-                        stack.push(true);
-                    else
-                        stack.push(false);
-                }
+                    case OpKind::ADD:
+                    {
+                        auto rhs = stack.pop();
+                        auto lhs = stack.pop();
+                        stack.push(lhs.getValue() + rhs.getValue());
+                        break;
+                    }
 
-                else if (op->op == ">")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto rhs = stack.pop();
-                    auto lhs = stack.pop();
-                    //rhs.assertType(TypeKind::INT, op->line);
-                    //lhs.assertType(TypeKind::INT, op->line);
-                    if (lhs.getValue() > rhs.getValue())
-                        stack.push(true);
-                    else
-                        stack.push(false);
-                }
+                    case OpKind::SUB:
+                    {
+                        auto rhs = stack.pop();
+                        auto lhs = stack.pop();
+                        stack.push(lhs.getValue() - rhs.getValue());
+                        break;
+                    }
 
-                else if (op->op == "<=")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto rhs = stack.pop();
-                    auto lhs = stack.pop();
-                    //rhs.assertType(TypeKind::INT, op->line);
-                    //lhs.assertType(TypeKind::INT, op->line);
-                    if (lhs.getValue() <= rhs.getValue())
-                        stack.push(true);
-                    else
-                        stack.push(false);
-                }
+                    case OpKind::MUL:
+                    {
+                        auto rhs = stack.pop();
+                        auto lhs = stack.pop();
+                        stack.push(lhs.getValue() * rhs.getValue());
+                        break;
+                    }
 
-                else if (op->op == ">=")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto rhs = stack.pop();
-                    auto lhs = stack.pop();
-                    //rhs.assertType(TypeKind::INT, op->line);
-                    //lhs.assertType(TypeKind::INT, op->line);
-                    if (lhs.getValue() >= rhs.getValue())
-                        stack.push(true);
-                    else
-                        stack.push(false);
-                }
+                    case OpKind::DIVMOD:
+                    {
+                        auto rhs = stack.pop();
+                        auto lhs = stack.pop();
+                        stack.push(lhs.getValue() / rhs.getValue());
+                        stack.push(lhs.getValue() % rhs.getValue());
+                        break;
+                    }
 
-                else if (op->op == "=")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto rhs = stack.pop();
-                    auto lhs = stack.pop();
-                    if (lhs.getValue() == rhs.getValue())
-                        stack.push(true);
-                    else
-                        stack.push(false);
-                }
+                    // COMPARISON
 
-                else if (op->op == "!=")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto rhs = stack.pop();
-                    auto lhs = stack.pop();
-                    if (lhs.getValue() != rhs.getValue())
-                        stack.push(true);
-                    else
-                        stack.push(false);
-                }
+                    case OpKind::LT:
+                    case OpKind::GT:
+                    case OpKind::LE:
+                    case OpKind::GE:
+                    case OpKind::EQ:
+                    case OpKind::NE:
+                    {
+                        auto rhs = stack.pop();
+                        auto lhs = stack.pop();
+                        stack.push(compare(op->kind, lhs.getValue(), rhs.getValue()));
+                        break;
+                    }
 
-                // BITWISE
+                    // BITWISE
 
-                else if (op->op == "shr")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto b = stack.pop();
-                    auto a = stack.pop();
-                    //b.assertType(TypeKind::INT, op->line);
-                    //a.assertType(TypeKind::INT, op->line);
-                    stack.push(a.getValue() >> b.getValue());
-                    break;
-                }
+                    case OpKind::SHR:
+                    {
+                        auto b = stack.pop();
+                        auto a = stack.pop();
+                        stack.push(a.getValue() >> b.getValue());
+                        break;
+                    }
 
-                else if (op->op == "shl")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto b = stack.pop();
-                    auto a = stack.pop();
-                    //b.assertType(TypeKind::INT, op->line);
-                    //a.assertType(TypeKind::INT, op->line);
-                    stack.push(a.getValue() << b.getValue());
-                    break;
-                }
+                    case OpKind::SHL:
+                    {
+                        auto b = stack.pop();
+                        auto a = stack.pop();
+                        stack.push(a.getValue() << b.getValue());
+                        break;
+                    }
 
-                else if (op->op == "or")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto b = stack.pop();
-                    auto a = stack.pop();
-                    //b.assertType(TypeKind::INT, op->line);
-                    //a.assertType(TypeKind::INT, op->line);
-                    stack.push(a.getValue() | b.getValue());
-                    break;
-                }
+                    case OpKind::OR:
+                    {
+                        auto b = stack.pop();
+                        auto a = stack.pop();
+                        stack.push(a.getValue() | b.getValue());
+                        break;
+                    }
 
-                else if (op->op == "and")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto b = stack.pop();
-                    auto a = stack.pop();
-                    //b.assertType(TypeKind::INT, op->line);
-                    //a.assertType(TypeKind::INT, op->line);
-                    stack.push(a.getValue() & b.getValue());
-                    break;
-                }
+                    case OpKind::AND:
+                    {
+                        auto b = stack.pop();
+                        auto a = stack.pop();
+                        stack.push(a.getValue() & b.getValue());
+                        break;
+                    }
 
-                else if (op->op == "not")
-                {
-                    //stack.assertMinSize(1, op->line);
-                    auto a = stack.pop();
-                    //a.assertType(TypeKind::INT, op->line);
-                    stack.push(~a.getValue());
-                    break;
-                }
+                    case OpKind::NOT:
+                    {
+                        auto a = stack.pop();
+                        stack.push(~a.getValue());
+                        break;
+                    }
 
-                // MEMOPS
+                    // MEMOPS
 
-                else if (op->op == "!8")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto ptr = stack.pop();
-                    auto byte = stack.pop();
-                    //ptr.assertType(TypeKind::PTR, op->line);
-                    //byte.assertType(TypeKind::INT, op->line);
-                    *((unsigned char *)ptr.getValue()) = byte.getValue() & 0xFF;
-                    break;
-                }
+                    case OpKind::STORE8:
+                    {
+                        auto ptr = stack.pop();
+                        if (options.checkMemory)
+                            checkAccess(ptr.getValue(), 1, true, exp->line);
+                        auto byte = stack.pop();
+                        *((unsigned char *)ptr.getValue()) = byte.getValue() & 0xFF;
+                        break;
+                    }
 
-                else if (op->op == "@8")
-                {
-                    //stack.assertMinSize(1, op->line);
-                    auto ptr = stack.pop();
-                    //ptr.assertType(TypeKind::PTR, op->line);
-                    long byte = (long)*((unsigned char *)ptr.getValue());
-                    stack.push(byte);
-                    break;
-                }
+                    case OpKind::LOAD8:
+                    {
+                        auto ptr = stack.pop();
+                        if (options.checkMemory)
+                            checkAccess(ptr.getValue(), 1, false, exp->line);
+                        long byte = (long)*((unsigned char *)ptr.getValue());
+                        stack.push(byte);
+                        break;
+                    }
 
-                else if (op->op == "!16")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto ptr = stack.pop();
-                    auto byte = stack.pop();
-                    //ptr.assertType(TypeKind::PTR, op->line);
-                    //byte.assertType(TypeKind::INT, op->line);
-                    *((unsigned short *)ptr.getValue()) = byte.getValue() & 0xFFFF;
-                    break;
-                }
+                    case OpKind::STORE16:
+                    {
+                        auto ptr = stack.pop();
+                        if (options.checkMemory)
+                            checkAccess(ptr.getValue(), 2, true, exp->line);
+                        auto byte = stack.pop();
+                        *((unsigned short *)ptr.getValue()) = byte.getValue() & 0xFFFF;
+                        break;
+                    }
 
-                else if (op->op == "@16")
-                {
-                    //stack.assertMinSize(1, op->line);
-                    auto ptr = stack.pop();
-                    //ptr.assertType(TypeKind::PTR, op->line);
-                    long byte = (long)*((unsigned short *)ptr.getValue());
-                    stack.push(byte);
-                    break;
-                }
+                    case OpKind::LOAD16:
+                    {
+                        auto ptr = stack.pop();
+                        if (options.checkMemory)
+                            checkAccess(ptr.getValue(), 2, false, exp->line);
+                        long byte = (long)*((unsigned short *)ptr.getValue());
+                        stack.push(byte);
+                        break;
+                    }
 
+                    case OpKind::STORE32:
+                    {
+                        auto ptr = stack.pop();
+                        if (options.checkMemory)
+                            checkAccess(ptr.getValue(), 4, true, exp->line);
+                        auto byte = stack.pop();
+                        *((unsigned int *)ptr.getValue()) = byte.getValue() & 0xFFFFFFFF;
+                        break;
+                    }
 
-                else if (op->op == "!32")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto ptr = stack.pop();
-                    auto byte = stack.pop();
-                    //ptr.assertType(TypeKind::PTR, op->line);
-                    //byte.assertType(TypeKind::INT, op->line);
-                    *((unsigned int *)ptr.getValue()) = byte.getValue() & 0xFFFFFFFF;
-                    break;
-                }
+                    case OpKind::LOAD32:
+                    {
+                        auto ptr = stack.pop();
+                        if (options.checkMemory)
+                            checkAccess(ptr.getValue(), 4, false, exp->line);
+                        long byte = (long)*((unsigned int *)ptr.getValue());
+                        stack.push(byte);
+                        break;
+                    }
 
-                else if (op->op == "@32")
-                {
-                    //stack.assertMinSize(1, op->line);
-                    auto ptr = stack.pop();
-                    //ptr.assertType(TypeKind::PTR, op->line);
-                    long byte = (long)*((unsigned int *)ptr.getValue());
-                    stack.push(byte);
-                    break;
-                }
+                    case OpKind::STORE64:
+                    {
+                        auto ptr = stack.pop();
+                        if (options.checkMemory)
+                            checkAccess(ptr.getValue(), 8, true, exp->line);
+                        auto byte = stack.pop();
+                        *((unsigned long *)ptr.getValue()) = byte.getValue();
+                        break;
+                    }
 
-                else if (op->op == "!64")
-                {
-                    //stack.assertMinSize(2, op->line);
-                    auto ptr = stack.pop();
-                    auto byte = stack.pop();
-                    //ptr.assertType(TypeKind::PTR, op->line);
-                    //byte.assertType(TypeKind::INT, op->line);
-                    *((unsigned long *)ptr.getValue()) = byte.getValue();
-                    break;
-                }
+                    case OpKind::LOAD64:
+                    {
+                        auto ptr = stack.pop();
+                        if (options.checkMemory)
+                            checkAccess(ptr.getValue(), 8, false, exp->line);
+                        long byte = (long)*((unsigned long *)ptr.getValue());
+                        stack.push(byte);
+                        break;
+                    }
 
-                else if (op->op == "@64")
-                {
-                    //stack.assertMinSize(1, op->line);
-                    auto ptr = stack.pop();
-                    //ptr.assertType(TypeKind::PTR, op->line);
-                    long byte = (long)*((unsigned long *)ptr.getValue());
-                    stack.push(byte);
-                    break;
-                }
+                    // CAST
 
-                // CAST
+                    case OpKind::CASTBOOL:
+                    {
+                        auto a = stack.pop();
+                        stack.push(a.getValue() > 0);
+                        break;
+                    }
 
-                else if (op->op == "cast(bool)")
-                {
-                    //stack.assertMinSize(1, op->line);
-                    auto a = stack.pop();
-                    if (a.getValue() > 0)
-                        stack.push(true);
-                    else
-                        stack.push(false);
-                    break;
-                }
+                    case OpKind::CASTINT:
+                    {
+                        auto a = stack.pop();
+                        stack.push(Data(a.getValue(), TypeKind::INT));
+                        break;
+                    }
 
-                else if (op->op == "cast(int)")
-                {
-                    //stack.assertMinSize(1, op->line);
-                    auto a = stack.pop();
-                    stack.push(Data(a.getValue(), TypeKind::INT));
-                    break;
-                }
+                    case OpKind::CASTPTR:
+                    {
+                        auto a = stack.pop();
+                        stack.push(Data(a.getValue(), TypeKind::PTR));
+                        break;
+                    }
 
-                else if (op->op == "cast(ptr)")
-                {
-                    //stack.assertMinSize(1, op->line);
-                    auto a = stack.pop();
-                    stack.push(Data(a.getValue(), TypeKind::PTR));
-                    break;
+                    default:
+                        break;
                 }
 
                 break;
@@ -1009,6 +1513,7 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
 
             case ASTKind::PRINTEXPR:
                 //stack.assertMinSize(1, exp->line);
+                syncSyscalls();
                 std::cout << stack.pop().getValue() << std::endl;
                 break;
 
@@ -1026,6 +1531,7 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
                 s += std::to_string(exp->line);
                 char* here = new char[s.length()];
                 std::strncpy(here, s.data(), s.length());
+                noteAlloc(here, s.length(), "here", siteFile(curProc, env), curProc, exp->line);
                 stack.push((long)s.length());
                 stack.push(here);
                 break;
@@ -1064,35 +1570,76 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
             }
 
             case ASTKind::SWAPEXPR:
-            {
-                //stack.assertMinSize(1, exp->line);
-                auto rhs = stack.pop();
-                auto lhs = stack.pop();
-                stack.push(rhs);
-                stack.push(lhs);
+                stack.swap(exp->line);
                 break;
-            }
 
             case ASTKind::ROTEXPR:
+                stack.rot(exp->line);
+                break;
+
+            case ASTKind::OVEREXPR:
+                stack.over(exp->line);
+                break;
+
+            case ASTKind::PERMUTEEXPR:
             {
-                //stack.assertMinSize(3, exp->line);
-                auto c = stack.pop();
-                auto b = stack.pop();
-                auto a = stack.pop();
-                stack.push(b);
-                stack.push(c);
-                stack.push(a);
+                auto p = (PermuteExpr *)exp;
+                stack.permute(p->depth, p->order, exp->line);
                 break;
             }
 
-            case ASTKind::OVEREXPR:
+            case ASTKind::SUPEREXPR:
             {
-                //stack.assertMinSize(2, exp->line);
-                auto b = stack.pop();
-                auto a = stack.pop();
-                stack.push(a);
-                stack.push(b);
-                stack.push(a);
+                auto s = (SuperExpr *)exp;
+                switch (s->kind)
+                {
+                    case SuperKind::ADDIMM:
+                    {
+                        stack.assertMinSize(1, exp->line);
+                        Data& a = stack.cell(0);
+                        a = Data(a.getValue() + s->imm, TypeKind::INT);
+                        break;
+                    }
+
+                    case SuperKind::DUPLOAD8:
+                        stack.assertMinSize(1, exp->line);
+                        if (options.checkMemory)
+                            checkAccess(stack.cell(0).getValue(), 1, false, exp->line);
+                        stack.push((long)*((unsigned char *)stack.cell(0).getValue()));
+                        break;
+
+                    case SuperKind::DUPLOAD64:
+                        stack.assertMinSize(1, exp->line);
+                        if (options.checkMemory)
+                            checkAccess(stack.cell(0).getValue(), 8, false, exp->line);
+                        stack.push((long)*((unsigned long *)stack.cell(0).getValue()));
+                        break;
+
+                    case SuperKind::OVEROVERCMP:
+                        stack.assertMinSize(2, exp->line);
+                        stack.push(compare(s->cmp, stack.cell(1).getValue(), stack.cell(0).getValue()));
+                        break;
+
+                    case SuperKind::SWAPSTORE8:
+                    {
+                        auto byte = stack.pop();
+                        auto ptr = stack.pop();
+                        if (options.checkMemory)
+                            checkAccess(ptr.getValue(), 1, true, exp->line);
+                        *((unsigned char *)ptr.getValue()) = byte.getValue() & 0xFF;
+                        break;
+                    }
+
+                    case SuperKind::SWAPSTORE64:
+                    {
+                        auto val = stack.pop();
+                        auto ptr = stack.pop();
+                        if (options.checkMemory)
+                            checkAccess(ptr.getValue(), 8, true, exp->line);
+                        *((unsigned long *)ptr.getValue()) = val.getValue();
+                        break;
+                    }
+                }
                 break;
             }
 
@@ -1104,4 +1651,11 @@ Data interpExpr(std::vector<Expr*> exps, Stack& stack, Env& env)
     }
 
     return stack.top();
+}
+
+Data interpExpr(const std::vector<Expr*>& exps, Stack& stack, Env& root, ProcCmd *rootProc)
+{
+    if (options.opStats)
+        return interpLoop<true>(exps, stack, root, rootProc);
+    return interpLoop<false>(exps, stack, root, rootProc);
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define CPPORTH_RUNTIME_H
 
 #include <unordered_map>
+#include <ostream>
 #include "ast.h"
 
 class Data
@@ -25,9 +26,9 @@ public:
 class Env
 {
 public:
-    std::unordered_map<std::string, Data> variables;
-    std::unordered_map<std::string, ProcCmd*> procs;
-    std::unordered_map<std::string, TypeCmd*> types;
+    std::unordered_map<Symbol, Data> variables;
+    std::unordered_map<Symbol, ProcCmd*> procs;
+    std::unordered_map<Symbol, TypeCmd*> types;
     std::vector<unsigned char *> toClean;
     std::vector<std::string> included;
     std::unordered_map<std::string, char*> strings;
@@ -44,9 +45,13 @@ public:
     bool containsKey(std::string);
     bool isIncluded(std::string);
     bool isProc(std::string);
+    bool isProc(Symbol);
     bool isVariable(std::string);
+    bool isVariable(Symbol);
     Data getVar(std::string);
+    Data getVar(Symbol);
     ProcCmd *getProc(std::string);
+    ProcCmd *getProc(Symbol);
 };
 
 
@@ -66,6 +71,11 @@ public:
     Data pop();
     Data peek();
     Data top();
+    void swap(int);
+    void rot(int);
+    void over(int);
+    void permute(int, const std::vector<int>&, int);
+    Data& cell(int);
     Stack scope(const ProcCmd*);
     int size();
     std::string toString();
@@ -74,14 +84,61 @@ public:
 class VariantData
 {
 public:
-    std::string name;
-    std::string parent;
+    Symbol name;
     std::vector<Data> values;
-    VariantData(std::string, std::string, std::vector<Data>);
+    VariantData(Symbol, std::vector<Data>);
+};
+
+enum class FrameKind
+{
+    BLOCK,          // running exps in [ip, end)
+    WHILE_COND,     // about to run the loop condition
+    WHILE_BODY,     // condition done: test it, then run the body
+    SCOPE,          // let/peek/match body done: unbind idents
+    PROC            // proc body done: drop its Env
+};
+
+// One entry of interpExpr's continuation stack. Control flow pushes frames
+// instead of recursing, so Porth recursion depth does not use native stack.
+class Frame
+{
+public:
+    FrameKind kind;
+    Expr *const *ip = nullptr;
+    Expr *const *end = nullptr;
+    WhileExpr *w = nullptr;
+    const std::vector<Symbol> *idents = nullptr;
+    std::unique_ptr<Env> env;
+    ProcCmd *proc = nullptr;            // PROC frames: the proc running in them
+    std::vector<std::string> recent;    // --ngrams window
+    static Frame block(const std::vector<Expr*>&);
+    static Frame single(Expr *const *);
+    static Frame loop(WhileExpr *);
+    static Frame scope(const std::vector<Symbol> *);
 };
 
+// A global `memory` block, kept so the compiler can place it in .bss.
+class MemoryRegion
+{
+public:
+    std::string name;
+    long addr;
+    long size;
+};
+
+std::vector<MemoryRegion>& globalMemory();
+
 std::vector<AST*> toAstVec(std::vector<Expr*>);
+bool compare(OpKind, long, long);
+// Prints the most frequent executed 2- and 3-grams collected under --ngrams.
+void dumpNgrams(std::ostream&, size_t);
+// Prints --op-stats counts per ASTKind and per op, and the hottest lines.
+void dumpOpStats(std::ostream&, size_t);
+// Runs the top-level commands (consts, memory, includes, ...) and optimizes
+// the procs, without calling main.
+void load(std::vector<AST*>, Env&);
 Data interp(std::vector<AST*>, Stack&, Env&);
-Data interpExpr(std::vector<Expr*>, Stack&, Env&);
+// proc is the proc exps is the body of, if any; --tiered counts its loops.
+Data interpExpr(const std::vector<Expr*>&, Stack&, Env&, ProcCmd *proc = nullptr);
 void include(std::string, Env&);
 #endif // CPPORTH_RUNTIME_H
\ No newline at end of file
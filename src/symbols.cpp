@@ -0,0 +1,45 @@
+#include "symbols.h"
+#include <deque>
+#include <unordered_map>
+
+// Function-local so other translation units can intern during static init.
+static std::unordered_map<std::string, Symbol>& ids()
+{
+    static std::unordered_map<std::string, Symbol> table;
+    return table;
+}
+
+// A deque never moves its elements, so symbolName's references stay valid.
+static std::deque<std::string>& names()
+{
+    static std::deque<std::string> table;
+    return table;
+}
+
+Symbol intern(const std::string& name)
+{
+    auto& table = ids();
+    auto it = table.find(name);
+    if (it != table.end())
+        return it->second;
+
+    Symbol sym = names().size();
+    names().push_back(name);
+    table.emplace(name, sym);
+    return sym;
+}
+
+bool findSymbol(const std::string& name, Symbol& sym)
+{
+    auto& table = ids();
+    auto it = table.find(name);
+    if (it == table.end())
+        return false;
+    sym = it->second;
+    return true;
+}
+
+const std::string& symbolName(Symbol sym)
+{
+    return names()[sym];
+}
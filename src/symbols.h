@@ -0,0 +1,16 @@
+#ifndef CPPORTH_SYMBOLS_H
+#define CPPORTH_SYMBOLS_H
+
+#include <cstdint>
+#include <string>
+
+// Every identifier is interned once, when its AST node is built.
+// Runtime lookups hash and compare these ids instead of strings.
+typedef uint32_t Symbol;
+
+Symbol intern(const std::string&);
+// Sets sym and returns true if name has been interned; never adds it.
+bool findSymbol(const std::string& name, Symbol& sym);
+const std::string& symbolName(Symbol);
+
+#endif // CPPORTH_SYMBOLS_H
@@ -1,22 +1,311 @@
 #include "syscalls.h"
 #include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
-long syscall(int syscallnum, std::vector<long> args) 
+// Submission/completion rings shared with the kernel.
+// Only the pieces needed for read/write/openat/close are mapped.
+class IoRing
+{
+    int fd = -1;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_sqe *sqes;
+    io_uring_cqe *cqes;
+    unsigned entries;
+    std::vector<std::vector<char> > pending;   // copies of queued write buffers
+    size_t pendingBytes = 0;
+    void *sqPtr = MAP_FAILED, *cqPtr = MAP_FAILED, *sqePtr = MAP_FAILED;
+    size_t sqSize = 0, cqSize = 0, sqeSize = 0;
+
+    io_uring_sqe *nextSqe();
+    void submit(unsigned, std::vector<long>&);
+public:
+    static const size_t MAX_PENDING_BYTES = 1 << 16;
+    bool init(unsigned);
+    ~IoRing();
+    long write(unsigned, const char *, size_t, bool queue);
+    long read(unsigned, char *, size_t);
+    long openat(int, const char *, int, int);
+    long close(unsigned);
+    void flush();
+};
+
+static IoRing *ring = nullptr;
+
+// On failure, whatever was set up is released by the destructor.
+bool IoRing::init(unsigned n)
+{
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    fd = (int)::syscall((long)__NR_io_uring_setup, n, &p);
+    if (fd < 0)
+        return false;
+
+    // IORING_OP_READ/WRITE/OPENAT/CLOSE and file-position writes arrived together (5.6).
+    if (!(p.features & IORING_FEAT_RW_CUR_POS))
+        return false;
+
+    sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+        sqSize = cqSize = std::max(sqSize, cqSize);
+
+    sqPtr = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqPtr == MAP_FAILED)
+        return false;
+    cqPtr = single ? sqPtr : mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cqPtr == MAP_FAILED)
+        return false;
+    sqeSize = p.sq_entries * sizeof(io_uring_sqe);
+    sqePtr = mmap(nullptr, sqeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqePtr == MAP_FAILED)
+        return false;
+
+    char *sq = (char *)sqPtr;
+    char *cq = (char *)cqPtr;
+    sqHead = (unsigned *)(sq + p.sq_off.head);
+    sqTail = (unsigned *)(sq + p.sq_off.tail);
+    sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+    sqArray = (unsigned *)(sq + p.sq_off.array);
+    cqHead = (unsigned *)(cq + p.cq_off.head);
+    cqTail = (unsigned *)(cq + p.cq_off.tail);
+    cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+    sqes = (io_uring_sqe *)sqePtr;
+    entries = p.sq_entries;
+    return true;
+}
+
+IoRing::~IoRing()
+{
+    flush();
+    if (sqePtr != MAP_FAILED)
+        munmap(sqePtr, sqeSize);
+    if (cqPtr != MAP_FAILED && cqPtr != sqPtr)
+        munmap(cqPtr, cqSize);
+    if (sqPtr != MAP_FAILED)
+        munmap(sqPtr, sqSize);
+    if (fd >= 0)
+        ::close(fd);
+}
+
+io_uring_sqe *IoRing::nextSqe()
+{
+    unsigned tail = *sqTail;
+    unsigned idx = tail & *sqMask;
+    io_uring_sqe *sqe = &sqes[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqArray[idx] = idx;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+// Submits everything on the ring and waits for all `count` completions.
+// results[user_data] receives each cqe's res.
+void IoRing::submit(unsigned count, std::vector<long>& results)
+{
+    results.assign(count, 0);
+    unsigned submitted = 0;
+    while (submitted < count)
+    {
+        long r = ::syscall((long)__NR_io_uring_enter, fd, count - submitted, count - submitted, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (r < 0)
+        {
+            std::cout << "Error: io_uring_enter failed: " << std::strerror(errno) << std::endl;
+            throw new std::exception();
+        }
+        submitted += r;
+    }
+
+    unsigned seen = 0;
+    while (seen < count)
+    {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+            ::syscall((long)__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            continue;
+        }
+        io_uring_cqe *cqe = &cqes[head & *cqMask];
+        results[cqe->user_data] = cqe->res;
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        seen++;
+    }
+}
+
+// Queued writes report the full count immediately; they are only queued
+// when the program drops the result, so a failed or short write can only be
+// reported, on stderr, when the batch is flushed. Other writes complete
+// before returning, after the queue, with a plain write(2): a one-entry
+// submit and wait would only cost more.
+long IoRing::write(unsigned wfd, const char *buf, size_t count, bool queue)
+{
+    if (!queue || pending.size() == entries || pendingBytes + count > MAX_PENDING_BYTES)
+        flush();
+
+    if (!queue)
+    {
+        auto res = ::write(wfd, buf, count);
+        return res < 0 ? -(long)errno : (long)res;
+    }
+
+    pending.emplace_back(buf, buf + count);
+    pendingBytes += count;
+
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = wfd;
+    sqe->addr = (unsigned long)pending.back().data();
+    sqe->len = count;
+    sqe->off = (unsigned long)-1;    // use and advance the file position
+    sqe->flags = IOSQE_IO_LINK;      // keep writes in program order
+    sqe->user_data = pending.size() - 1;
+    return (long)count;
+}
+
+void IoRing::flush()
+{
+    if (pending.empty())
+        return;
+
+    // The last sqe in a batch must not carry IO_LINK.
+    sqes[(*sqTail - 1) & *sqMask].flags = 0;
+
+    std::vector<long> results;
+    submit(pending.size(), results);
+    for (size_t i = 0; i < pending.size(); i++)
+        if (results[i] != (long)pending[i].size())
+            std::cerr << "Error: batched write " << i << " returned " << results[i]
+                << " (expected " << pending[i].size() << ")" << std::endl;
+
+    pending.clear();
+    pendingBytes = 0;
+}
+
+long IoRing::read(unsigned rfd, char *buf, size_t count)
+{
+    flush();
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = rfd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = count;
+    sqe->off = (unsigned long)-1;
+    std::vector<long> results;
+    submit(1, results);
+    return results[0];
+}
+
+long IoRing::openat(int dirfd, const char *path, int flags, int mode)
+{
+    flush();
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = dirfd;
+    sqe->addr = (unsigned long)path;
+    sqe->len = mode;
+    sqe->open_flags = flags;
+    std::vector<long> results;
+    submit(1, results);
+    return results[0];
+}
+
+long IoRing::close(unsigned cfd)
+{
+    flush();
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = cfd;
+    std::vector<long> results;
+    submit(1, results);
+    return results[0];
+}
+
+bool enableIoUring()
+{
+    auto r = new IoRing();
+    if (!r->init(64))
+    {
+        delete r;
+        return false;
+    }
+    ring = r;
+    std::atexit(closeIoUring);
+    return true;
+}
+
+void syncSyscalls()
+{
+    if (ring)
+        ring->flush();
+}
+
+void closeIoUring()
+{
+    delete ring;
+    ring = nullptr;
+}
+
+long syscall(int syscallnum, std::vector<long> args, bool resultUsed)
 {
     switch (syscallnum)
     {
+        case 0: // sys_read
+        {
+            unsigned int fd = (unsigned int)(args[0] & 0xFFFFFF);
+            char *buf = (char *)(args[1]);
+            size_t count = (size_t)args[2];
+            if (ring)
+                return ring->read(fd, buf, count);
+            auto res = read(fd, buf, count);
+            return res < 0 ? -(long)errno : (long)res;
+        }
+
         case 1: // sys_write
         {
             unsigned int fd = (unsigned int)(args[0] & 0xFFFFFF);
             const char *buf = (const char *)(args[1]);
             size_t count = (size_t)args[2];
+            if (ring)
+                return ring->write(fd, buf, count, !resultUsed);
             auto res = write(fd, buf, count);
-            return (long)res;
+            return res < 0 ? -(long)errno : (long)res;
+        }
+
+        case 3: // sys_close
+        {
+            unsigned int fd = (unsigned int)(args[0] & 0xFFFFFF);
+            if (ring)
+                return ring->close(fd);
+            auto res = close(fd);
+            return res < 0 ? -(long)errno : (long)res;
+        }
+
+        case 257: // sys_openat
+        {
+            int dirfd = (int)args[0];
+            const char *path = (const char *)(args[1]);
+            int flags = (int)args[2];
+            int mode = args.size() > 3 ? (int)args[3] : 0;
+            if (ring)
+                return ring->openat(dirfd, path, flags, mode);
+            auto res = openat(dirfd, path, flags, mode);
+            return res < 0 ? -(long)errno : (long)res;
         }
 
         default:
+            syncSyscalls();
             std::cout << "Error: Syscall not implemented: " << syscallnum << std::endl;
             return 0;
     }
-}
\ No newline at end of file
+}
@@ -3,6 +3,18 @@
 
 #include <vector>
 
-long syscall(int, std::vector<long>);
+// resultUsed is false when the caller drops the result (`syscall3 drop`).
+long syscall(int, std::vector<long>, bool resultUsed = true);
 
-#endif // CPPORTH_SYSCALLS_H
\ No newline at end of file
+// io_uring batching (opt-in with --io-uring).
+// Writes whose result is dropped are queued on the submission ring and
+// submitted together at sync points: any other syscall, print, a full ring,
+// or syncSyscalls(). Every other call waits for its own completion, so the
+// program sees the same results as with plain syscalls.
+// Falls back to plain syscalls when the kernel has no io_uring.
+bool enableIoUring();
+void syncSyscalls();
+// Flushes the queue and unmaps and closes the ring.
+void closeIoUring();
+
+#endif // CPPORTH_SYSCALLS_H
@@ -2,6 +2,18 @@
 #include "../src/lexer.h"
 #include "../src/parser.h"
 #include "../src/helper.h"
+#include "../src/ir.h"
+#include "../src/args.h"
+#include "../src/codegen.h"
+#include "../src/profiler.h"
+#include "../src/native.h"
+#include "../src/bytescan.h"
+#include "../src/syscalls.h"
+#include "../src/optimizer.h"
+#include <unistd.h>
+#include <csignal>
+#include <sstream>
+#include <unordered_set>
 
 TEST (CPPorth, EnvSetPath) {
     std::string fullpath = "porth/std/std.porth";
@@ -61,6 +73,981 @@ TEST (CPPorth, Include2)
     p.cleanup(asts);
 }
 
+TEST (CPPorth, DeadProcElimination)
+{
+    std::string code =  "type T | a[n :: int] end\n";
+                code += "type U | b[n :: int] end\n";
+                code += "proc unused in new T::a[1] drop end\n";
+                code += "proc target int -- int in 2 * end\n";
+                code += "proc used int -- int in new U::b[1] drop 1 + end\n";
+                code += "proc main in 1 used addr-of target call-like target drop end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    interp(asts, s, e);
+
+    ASSERT_TRUE(e.isProc("main"));
+    ASSERT_TRUE(e.isProc("used"));
+    ASSERT_TRUE(e.isProc("target"));
+    ASSERT_FALSE(e.isProc("unused"));
+    ASSERT_TRUE(e.types.find(intern("U")) != e.types.end());
+    ASSERT_TRUE(e.types.find(intern("T")) == e.types.end());
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, ConstFolding)
+{
+    std::string code =  "const N 4 end\n";
+                code += "const ON 1 1 = end\n";
+                code += "proc f -- int in N 8 * 1 + end\n";
+                code += "proc g -- int in ON if 10 else 20 end N 3 divmod + end\n";
+                code += "proc h int -- int in let N in N end end\n";
+                code += "proc main in f g 5 h drop drop drop end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    interp(asts, s, e);
+
+    auto f = e.getProc("f")->body;
+    ASSERT_EQ(f.size(), 1);
+    ASSERT_EQ(f[0]->getASTKind(), ASTKind::IMMEXPR);
+    ASSERT_EQ(((ImmExpr *)f[0])->value, 33);
+
+    auto g = e.getProc("g")->body;
+    ASSERT_EQ(g.size(), 2);
+    ASSERT_EQ(((ImmExpr *)g[0])->value, 10);
+    ASSERT_EQ(((ImmExpr *)g[1])->value, 2);
+
+    auto let = (LetExpr *)e.getProc("h")->body[0];
+    ASSERT_EQ(let->body[0]->getASTKind(), ASTKind::VAREXPR);
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, ShuffleElimination)
+{
+    std::string code =  "proc f int int -- int int in swap swap end\n";
+                code += "proc g int -- int int int in 1 2 swap rot end\n";
+                code += "proc h int int int -- int int int in rot rot end\n";
+                code += "proc k int int -- bool in swap < end\n";
+                code += "proc main in 1 2 f 3 g 4 5 6 h 7 8 k end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    interp(asts, s, e);
+
+    ASSERT_EQ(e.getProc("f")->body.size(), 0);
+
+    auto g = e.getProc("g")->body;
+    ASSERT_EQ(g.size(), 3);
+    ASSERT_EQ(g[2]->getASTKind(), ASTKind::PERMUTEEXPR);
+
+    auto h = e.getProc("h")->body;
+    ASSERT_EQ(h.size(), 1);
+    ASSERT_EQ(((PermuteExpr *)h[0])->order, std::vector<int>({2, 0, 1}));
+
+    auto k = e.getProc("k")->body;
+    ASSERT_EQ(k.size(), 1);
+    ASSERT_EQ(((OpExpr *)k[0])->op, ">");
+
+    auto res = s.toVector();
+    std::vector<long> values;
+    for (auto d : res)
+        values.push_back(d.getValue());
+    ASSERT_EQ(values, std::vector<long>({1, 2, 2, 1, 3, 6, 4, 5, 0}));
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, Superinstructions)
+{
+    std::string code =  "memory m 8 end\n";
+                code += "proc a int -- int in 5 - end\n";
+                code += "proc b int int -- int int bool in over over < end\n";
+                code += "proc c ptr int in swap !64 end\n";
+                code += "proc d ptr -- ptr int in dup cast(ptr) @64 end\n";
+                code += "proc main in 3 a 1 2 b m 42 c m d swap drop end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    interp(asts, s, e);
+
+    auto a = e.getProc("a")->body;
+    ASSERT_EQ(a.size(), 1);
+    ASSERT_EQ(((SuperExpr *)a[0])->kind, SuperKind::ADDIMM);
+    ASSERT_EQ(((SuperExpr *)a[0])->imm, -5);
+
+    auto b = e.getProc("b")->body;
+    ASSERT_EQ(b.size(), 1);
+    ASSERT_EQ(((SuperExpr *)b[0])->kind, SuperKind::OVEROVERCMP);
+
+    ASSERT_EQ(((SuperExpr *)e.getProc("c")->body[0])->kind, SuperKind::SWAPSTORE64);
+    ASSERT_EQ(((SuperExpr *)e.getProc("d")->body[0])->kind, SuperKind::DUPLOAD64);
+
+    auto res = s.toVector();
+    std::vector<long> values;
+    for (auto d : res)
+        values.push_back(d.getValue());
+    ASSERT_EQ(values, std::vector<long>({-2, 1, 2, 1, 42}));
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, CompareAndBranch)
+{
+    std::string code =  "proc sign int -- int in\n";
+                code += "  dup 0 < if drop 0 1 -\n";
+                code += "  else dup 0 = if* drop 0\n";
+                code += "  else drop 1 end\n";
+                code += "end\n";
+                code += "proc main in 0 while dup 3 < do 1 + end 5 sign 0 sign 0 4 - sign end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    interp(asts, s, e);
+
+    auto sign = e.getProc("sign")->body;
+    ASSERT_EQ(sign.size(), 3);
+    auto f = (IfExpr *)sign[2];
+    ASSERT_EQ(f->cmp, OpKind::LT);
+    ASSERT_EQ(f->next->cmp, OpKind::EQ);
+    ASSERT_EQ(f->elze.size(), 2);
+
+    auto w = (WhileExpr *)e.getProc("main")->body[1];
+    ASSERT_EQ(w->cmp, OpKind::LT);
+    ASSERT_EQ(w->cond.size(), 2);
+
+    auto res = s.toVector();
+    std::vector<long> values;
+    for (auto d : res)
+        values.push_back(d.getValue());
+    ASSERT_EQ(values, std::vector<long>({3, 1, 0, -1}));
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, TailCalls)
+{
+    std::string code =  "proc even int -- int in dup 0 = if drop 1 else 1 - odd end end\n";
+                code += "proc odd int -- int in dup 0 = if drop 0 else 1 - even end end\n";
+                code += "proc count int -- int in dup 0 > if 1 - count end end\n";
+                code += "proc main in 100001 even 100000 count end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    interp(asts, s, e);
+
+    auto res = s.toVector();
+    std::vector<long> values;
+    for (auto d : res)
+        values.push_back(d.getValue());
+    ASSERT_EQ(values, std::vector<long>({0, 0}));
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, IndirectCalls)
+{
+    std::string code =  "proc inc int -- int in 1 + end\n";
+                code += "proc dbl int -- int in 2 * end\n";
+                code += "proc apply int addr -- int in call-like inc end\n";
+                code += "proc main in 5 addr-of inc apply addr-of dbl apply addr-of dbl apply addr-of inc end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    interp(asts, s, e);
+
+    auto res = s.toVector();
+    ASSERT_EQ(res[0].getValue(), 24);
+    ASSERT_EQ(res[1].getType(), TypeKind::ADDR);
+    ASSERT_EQ(ProcCmd::table[res[1].getValue()], e.getProc("inc"));
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, IR)
+{
+    std::string code =  "proc sum int int -- int in let k n in 0 0 while dup n < do swap k k * + swap 1 + end drop end end\n";
+                code += "proc count int -- int in dup 0 > if 1 - count end end\n";
+                code += "proc main in 3 4 sum 100000 count \"s\" drop drop end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    options.ir = true;
+    interp(asts, s, e);
+    options.ir = false;
+
+    // main uses a string literal and stays on the interpreter
+    ASSERT_EQ(e.getProc("main")->ir, nullptr);
+
+    auto sum = e.getProc("sum")->ir;
+    ASSERT_NE(sum, nullptr);
+    ASSERT_EQ(sum->loops.size(), 1);
+    // k k * is hoisted out of the loop into the entry block
+    auto& entry = sum->blocks[0].insts;
+    ASSERT_TRUE(std::any_of(entry.begin(), entry.end(), [](const IRInst& i) { return i.op == IROp::BIN && i.kind == OpKind::MUL; }));
+
+    auto& count = e.getProc("count")->ir->blocks;
+    ASSERT_TRUE(std::any_of(count.begin(), count.end(), [](const IRBlock& b) { return b.insts.back().op == IROp::TAILCALL; }));
+
+    auto res = s.toVector();
+    std::vector<long> values;
+    for (auto d : res)
+        values.push_back(d.getValue());
+    ASSERT_EQ(values, std::vector<long>({36, 0}));
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, TieredExecution)
+{
+    std::string code =  "proc inc int -- int in 1 + end\n";
+                code += "proc cold int -- int in 2 * end\n";
+                code += "proc main in 0 while dup 10 < do inc end 1 cold 0 while dup 10 < do 1 + end end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    options.tiered = true;
+    options.tierThreshold = 3;
+    interp(asts, s, e);
+    options.tiered = false;
+    options.tierThreshold = 1000;
+
+    auto inc = e.getProc("inc");
+    ASSERT_NE(inc->ir, nullptr);
+    // the first loop was replaced by IR, which calls inc without counting
+    ASSERT_LT(inc->calls, 10);
+    ASSERT_EQ(e.getProc("cold")->ir, nullptr);
+    ASSERT_EQ(e.getProc("cold")->calls, 1);
+
+    auto res = s.toVector();
+    std::vector<long> values;
+    for (auto d : res)
+        values.push_back(d.getValue());
+    ASSERT_EQ(values, std::vector<long>({10, 2, 10}));
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, TieredLoopCache)
+{
+    std::string code =  "proc main in\n";
+                code += "    0 while dup 20 < do 0 while dup 10 < do 1 + end drop 1 + end\n";
+                code += "    5 let k in 0 while dup k < do 1 + end end\n";
+                code += "end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    options.tiered = true;
+    options.tierThreshold = 3;
+    interp(asts, s, e);
+    options.tiered = false;
+    options.tierThreshold = 1000;
+
+    std::vector<WhileExpr*> loops;      // innermost first
+    walkBodies(e.getProc("main")->body, [&](std::vector<Expr*>& list, std::vector<Symbol>&) {
+        for (auto exp : list)
+            if (exp->getASTKind() == ASTKind::WHILEEXPR)
+                loops.push_back((WhileExpr *)exp);
+    });
+    ASSERT_EQ(loops.size(), 3u);
+    // the nested loop is lowered once and kept; the one that bakes in k is not
+    ASSERT_NE(loops[0]->osr, nullptr);
+    ASSERT_EQ(loops[1]->osr, nullptr);
+    ASSERT_EQ(s.pop().getValue(), 5);
+    ASSERT_EQ(s.pop().getValue(), 20);
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, OpStats)
+{
+    std::string code =  "proc sq int -- int in dup * end\n";
+                code += "proc main in\n";
+                code += "    0 while dup 50 < do 1 + end\n";
+                code += "    sq drop\n";
+                code += "end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    options.opStats = true;
+    options.superinstructions = false;
+    interp(asts, s, e);
+    options.opStats = false;
+    options.superinstructions = true;
+
+    std::ostringstream out;
+    dumpOpStats(out, 1);
+    auto report = out.str();
+
+    // 0 and while once, dup 50 < 51 times, 1 + 50 times
+    ASSERT_NE(report.find("  255\tmain:3\n"), std::string::npos);
+    ASSERT_NE(report.find("\t*\n"), std::string::npos);
+    ASSERT_EQ(report.find("sq:1"), std::string::npos);
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, Profiler)
+{
+    std::string code =  "proc leaf int -- int in 1 + end\n";
+                code += "proc mid int -- int in leaf leaf 0 + end\n";
+                code += "proc main in 0 mid mid leaf drop end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    options.profile = true;
+    interp(asts, s, e);
+    options.profile = false;
+
+    std::ostringstream out;
+    dumpProfile(out, 3);
+    auto report = out.str();
+
+    ASSERT_NE(report.find("  leaf\n"), std::string::npos);
+    ASSERT_NE(report.find("4  <- mid\n"), std::string::npos);
+    ASSERT_NE(report.find("1  <- main\n"), std::string::npos);
+    ASSERT_NE(report.find("1  <- <top>\n"), std::string::npos);
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, ProfilerIR)
+{
+    std::string code =  "proc irleaf int -- int in 1 + end\n";
+                code += "proc irmid int -- int in irleaf irleaf 0 + end\n";
+                code += "proc main in 0 irmid irmid irleaf drop end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    options.profile = true;
+    options.ir = true;
+    interp(asts, s, e);
+    options.ir = false;
+    options.profile = false;
+
+    std::ostringstream out;
+    dumpProfile(out, 3);
+    auto report = out.str();
+
+    // calls between procs running on the IR VM are counted too
+    ASSERT_NE(e.getProc("irmid")->ir, nullptr);
+    ASSERT_NE(report.find("  irleaf\n"), std::string::npos);
+    ASSERT_NE(report.find("4  <- irmid\n"), std::string::npos);
+    ASSERT_NE(report.find("2  <- main\n"), std::string::npos);
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, Sampler)
+{
+    std::string code =  "proc leaf in end\n";
+                code += "proc main in leaf end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Env e;
+    auto asts = p.parse();
+    load(asts, e);
+
+    // a 1 Hz timer does not fire during the test, so every sample is raised
+    options.sampleHz = 1;
+    startSampling(1);
+    raise(SIGPROF);
+    profileEnter(e.getProc("main"));
+    noteSampleLine(2);
+    raise(SIGPROF);
+    profileEnter(e.getProc("leaf"));
+    // more samples than one chunk holds
+    for (int i = 0; i < 600; i++)
+    {
+        noteSampleLine(1);
+        raise(SIGPROF);
+    }
+    profileExit();
+    profileExit();
+
+    std::ostringstream out;
+    dumpSamples(out);
+    options.sampleHz = 0;
+
+    ASSERT_EQ(out.str(), "<top> 1\nmain;leaf;leaf:1 600\nmain;main:2 1\n");
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, HeapProfile)
+{
+    std::string code =  "proc keep in 24 alloc drop end\n";
+                code += "proc main in\n";
+                code += "    8 alloc free keep keep\n";
+                code += "end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    e.filepath = "heap.porth";
+    auto asts = p.parse();
+    options.heapProfile = true;
+    interp(asts, s, e);
+    options.heapProfile = false;
+
+    std::ostringstream out;
+    dumpHeapProfile(out);
+    auto report = out.str();
+    auto leaks = report.substr(report.find("unfreed at exit:"));
+
+    ASSERT_NE(report.find("          48         2            48  alloc at heap.porth:1 (keep)\n"), std::string::npos);
+    ASSERT_NE(report.find("           8         1             8  alloc at heap.porth:3 (main)\n"), std::string::npos);
+    ASSERT_NE(leaks.find("48 bytes in 2 blocks  alloc at heap.porth:1 (keep)\n"), std::string::npos);
+    ASSERT_EQ(leaks.find("heap.porth:3"), std::string::npos);
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, CheckMemory)
+{
+    std::string code =  "memory buf 16 end\n";
+                code += "proc fill int in\n";
+                code += "    0 while over over > do dup dup buf + !8 1 + end drop drop\n";
+                code += "end\n";
+
+    Lexer l(code + "proc main in 16 fill buf 15 + @8 8 alloc let p in 7 p !64 p @64 p free end end\n");
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    options.checkMemory = true;
+    interp(asts, s, e);
+
+    ASSERT_EQ(s.pop().getValue(), 7);
+    ASSERT_EQ(s.pop().getValue(), 15);
+
+    Lexer l2(code + "proc main in 17 fill end\n");
+    Parser p2(l2.lex());
+
+    Stack s2;
+    Env e2;
+    auto asts2 = p2.parse();
+    ASSERT_THROW(interp(asts2, s2, e2), std::exception*);
+    options.checkMemory = false;
+
+    p.cleanup(asts);
+    p2.cleanup(asts2);
+}
+
+TEST (CPPorth, StackUnderflow)
+{
+    Stack s;
+    s.push(1L);
+
+    testing::internal::CaptureStdout();
+    ASSERT_THROW(s.swap(3), std::exception*);
+    ASSERT_EQ(testing::internal::GetCapturedStdout(), "Error:3: operation requires at least 2 items\n");
+}
+
+// Deletes the procs and types an include added to e. The parser's own ASTs
+// are freed by cleanup.
+static void cleanupIncluded(Env& e, const std::vector<AST*>& asts)
+{
+    std::unordered_set<AST*> owned(asts.begin(), asts.end());
+    for (auto& [name, proc] : e.procs)
+        if (!owned.count(proc))
+            delete proc;
+    for (auto& [name, type] : e.types)
+        if (!owned.count(type))
+            delete type;
+}
+
+// Runs code after including tests/nativestd.porth, with the native builtins
+// on or off, and returns the values it leaves on the stack.
+static std::vector<long> runNativeStd(const std::string& code, bool native)
+{
+    options.nativeStd = native;
+    Lexer l("include \"tests/nativestd.porth\"\n" + code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    interp(asts, s, e);
+    options.nativeStd = true;
+
+    std::vector<long> res;
+    for (auto& d : s.toVector())
+        res.push_back(d.getValue());
+    cleanupIncluded(e, asts);
+    p.cleanup(asts);
+    return res;
+}
+
+TEST (CPPorth, NativeStdBinds)
+{
+    std::string code =  "include \"tests/nativestd.porth\"\n";
+                code += "proc len2 ptr -- int in cstrlen dup + end\n";
+                code += "proc main in \"abc\"c len2 end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    options.ir = true;
+    options.deadProcElim = false;
+    interp(asts, s, e);
+    options.ir = false;
+    options.deadProcElim = true;
+
+    for (auto& n : nativeProcs())
+        ASSERT_EQ(e.getProc(n.name)->native, n.fn);
+
+    bool calledNative = false;
+    for (auto& b : e.getProc("len2")->ir->blocks)
+        for (auto& i : b.insts)
+            calledNative |= i.op == IROp::NATIVE;
+    ASSERT_TRUE(calledNative);
+    ASSERT_EQ(s.pop().getValue(), 6);
+
+    cleanupIncluded(e, asts);
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, NativeMemcpy)
+{
+    std::string code =  "memory buf 32 end\n";
+                code += "proc main in\n";
+                code += "    11 \"hello world\" swap drop buf memcpy buf -\n";
+                code += "    buf @64 buf 3 + @64\n";
+                code += "    8 buf buf 2 + memcpy buf - buf @64\n";
+                code += "    0 buf buf memcpy buf - buf 16 + @64\n";
+                code += "end\n";
+
+    auto porth = runNativeStd(code, false);
+    ASSERT_EQ(porth, runNativeStd(code, true));
+    ASSERT_EQ(porth[0], 0);
+    ASSERT_EQ(porth[3], 2);
+}
+
+TEST (CPPorth, NativeMemset)
+{
+    std::string code =  "memory buf 16 end\n";
+                code += "proc main in\n";
+                code += "    16 0 buf memset drop\n";
+                code += "    10 'x' buf 3 + memset buf - buf @64 buf 8 + @64\n";
+                code += "    4 321 buf memset drop buf @64\n";
+                code += "end\n";
+
+    auto porth = runNativeStd(code, false);
+    ASSERT_EQ(porth, runNativeStd(code, true));
+    ASSERT_EQ(porth[0], 3);
+}
+
+TEST (CPPorth, NativeCstrlenCstreq)
+{
+    std::string code =  "proc main in\n";
+                code += "    \"hello\"c cstrlen \"\"c cstrlen\n";
+                code += "    \"abc\"c \"abc\"c cstreq \"abc\"c \"abd\"c cstreq \"ab\"c \"abc\"c cstreq \"\"c \"\"c cstreq\n";
+                code += "end\n";
+
+    auto porth = runNativeStd(code, false);
+    ASSERT_EQ(porth, runNativeStd(code, true));
+    ASSERT_EQ(porth, std::vector<long>({5, 0, 1, 0, 0, 1}));
+}
+
+TEST (CPPorth, NativeStreq)
+{
+    std::string code =  "proc main in\n";
+                code += "    \"abc\" \"abc\" streq \"abc\" \"abd\" streq \"ab\" \"abc\" streq \"\" \"\" streq\n";
+                code += "end\n";
+
+    auto porth = runNativeStd(code, false);
+    ASSERT_EQ(porth, runNativeStd(code, true));
+    ASSERT_EQ(porth, std::vector<long>({1, 0, 0, 1}));
+}
+
+TEST (CPPorth, NativeStrChopByDelim)
+{
+    std::string code =  "memory line 16 end\n";
+                code += "memory word 16 end\n";
+                code += "proc chop int in line word str-chop-by-delim end\n";
+                code += "proc main in\n";
+                code += "    \"foo,bar,,baz\" line 8 + !64 line !64\n";
+                code += "    ',' chop word @64 line @64 word 8 + @64 @8\n";
+                code += "    ',' chop word @64 line @64\n";
+                code += "    ',' chop word @64 line @64\n";
+                code += "    ',' chop word @64 line @64 word 8 + @64 @8\n";
+                code += "    ',' chop word @64 line @64\n";
+                code += "    300 chop word @64 line @64\n";
+                code += "end\n";
+
+    auto porth = runNativeStd(code, false);
+    ASSERT_EQ(porth, runNativeStd(code, true));
+    ASSERT_EQ(porth, std::vector<long>({3, 8, 'f', 3, 4, 0, 3, 3, 0, 'b', 0, 0, 0, 0}));
+}
+
+TEST (CPPorth, NativeFputu)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::string fd = std::to_string(fds[1]);
+    std::string code = "proc main in 0 " + fd + " fputu 1234567890 " + fd + " fputu 7 " + fd + " fputu end\n";
+
+    char buf[64];
+    runNativeStd(code, false);
+    std::string porth(buf, read(fds[0], buf, sizeof(buf)));
+    runNativeStd(code, true);
+    std::string native(buf, read(fds[0], buf, sizeof(buf)));
+    close(fds[0]);
+    close(fds[1]);
+
+    ASSERT_EQ(porth, "012345678907");
+    ASSERT_EQ(native, porth);
+}
+
+TEST (CPPorth, ByteScanLevels)
+{
+    // Lengths around the 16 and 32 byte blocks, matches in the tail and at
+    // the last byte, bytes above 127 (signed compares) and a set over 16.
+    std::vector<unsigned char> buf(100), other;
+    for (size_t i = 0; i < buf.size(); i++)
+        buf[i] = (i * 37 + 11) % 251;
+    other = buf;
+    other[70] = 255;
+    unsigned char small[] = {200, 5, 99}, large[20];
+    for (int i = 0; i < 20; i++)
+        large[i] = 220 + i;
+
+    std::vector<long> expected;
+    for (auto level : {ScanLevel::SCALAR, ScanLevel::SSE42, ScanLevel::AVX2})
+    {
+        setScanLevel(level);
+        std::vector<long> res;
+        for (long n : {0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 71, 100})
+        {
+            res.push_back(scanMemchr(buf.data(), n, buf[n > 0 ? n - 1 : 0]));
+            res.push_back(scanMemchr(buf.data(), n, 250));
+            res.push_back(scanMemcmp(buf.data(), other.data(), n));
+            res.push_back(scanMemcmp(other.data(), buf.data(), n));
+            res.push_back(scanFindByteSet(buf.data(), n, small, 3));
+            res.push_back(scanFindByteSet(buf.data(), n, large, 20));
+            res.push_back(scanCountByte(buf.data(), n, buf[3]));
+        }
+        if (expected.empty())
+            expected = res;
+        ASSERT_EQ(res, expected) << scanLevelName(level);
+    }
+    setScanLevel(ScanLevel::AVX2);
+
+    ASSERT_EQ(scanMemchr(buf.data(), 100, 256 + buf[5]), -1);
+    ASSERT_EQ(scanMemcmp(buf.data(), other.data(), 100), -1);
+}
+
+TEST (CPPorth, ByteScanBuiltins)
+{
+    std::string code =  "proc main in\n";
+                code += "    \"a,b;c,d\" ';' memchr \"a,b;c,d\" 'x' memchr\n";
+                code += "    \"a,b;c,d\" \";,\" find-byte-set \"a,b;c,d\" ',' count-byte\n";
+                code += "    3 \"abc\" swap drop \"abd\" swap drop memcmp\n";
+                code += "end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    interp(asts, s, e);
+
+    ASSERT_EQ(s.pop().getValue(), -1);
+    ASSERT_EQ(s.pop().getValue(), 2);
+    ASSERT_EQ(s.pop().getValue(), 1);
+    ASSERT_EQ(s.pop().getValue(), -1);
+    ASSERT_EQ(s.pop().getValue(), 3);
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, ByteScanShadowed)
+{
+    // procs written before memchr became a builtin still get called
+    std::string code =  "proc memchr int -- int in 10 * end\n";
+                code += "proc main in 4 memchr \"ab\" 'b' count-byte end\n";
+
+    for (bool lazy : {false, true})
+    {
+        // an unreachable lazy body is still never parsed
+        Lexer l(lazy ? code + "proc broken in : end\n" : code);
+        Parser p(l.lex(), lazy);
+
+        Stack s;
+        Env e;
+        auto asts = p.parse();
+        interp(asts, s, e);
+
+        ASSERT_EQ(s.pop().getValue(), 1);
+        ASSERT_EQ(s.pop().getValue(), 40);
+        p.cleanup(asts);
+    }
+}
+
+TEST (CPPorth, Extern)
+{
+    std::string code =  "extern \"libc.so.6\" \"strlen\" ptr -- ptr\n";
+                code += "extern \"libc.so.6\" \"labs\" int -- ptr\n";
+                code += "extern \"libc.so.6\" \"strcmp\" ptr ptr -- int\n";
+                code += "extern \"libc.so.6\" \"memset\" ptr int int -- ptr\n";
+                code += "memory buf 8 end\n";
+                code += "proc len2 ptr -- int in strlen dup + end\n";
+                code += "proc main in\n";
+                code += "    \"abc\"c len2 -7 labs\n";
+                code += "    buf 'x' 7 memset strlen \"a\"c \"b\"c strcmp\n";
+                code += "end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    options.ir = true;
+    options.deadProcElim = false;
+    interp(asts, s, e);
+    options.ir = false;
+    options.deadProcElim = true;
+
+    ASSERT_NE(e.getProc("strlen")->thunk, nullptr);
+    bool calledExtern = false;
+    for (auto& b : e.getProc("len2")->ir->blocks)
+        for (auto& i : b.insts)
+            calledExtern |= i.op == IROp::NATIVE && i.callee->name == "strlen";
+    ASSERT_TRUE(calledExtern);
+    // a negative C int result stays negative
+    ASSERT_LT(s.pop().getValue(), 0);
+    ASSERT_EQ(s.pop().getValue(), 7);
+    ASSERT_EQ(s.pop().getValue(), 7);
+    ASSERT_EQ(s.pop().getValue(), 6);
+
+    Lexer l2("extern \"libc.so.6\" \"no-such-symbol\" -- int\nproc main in end\n");
+    Parser p2(l2.lex());
+
+    Stack s2;
+    Env e2;
+    auto asts2 = p2.parse();
+    ASSERT_THROW(interp(asts2, s2, e2), std::exception*);
+
+    p.cleanup(asts);
+    p2.cleanup(asts2);
+}
+
+TEST (CPPorth, IoUring)
+{
+    if (!enableIoUring())
+        GTEST_SKIP() << "io_uring unavailable";
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::string fd = std::to_string(fds[1]);
+    std::string code =  "proc main in\n";
+                code += "    \"ab\\n\" " + fd + " 1 syscall3\n";
+                code += "    \"cd\\n\" 9999 1 syscall3\n";
+                code += "    \"ef\\n\" " + fd + " 1 syscall3 drop\n";
+                code += "end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    interp(asts, s, e);
+    closeIoUring();
+
+    // results the program reads are those of the completed write
+    ASSERT_EQ(s.pop().getValue(), -EBADF);
+    ASSERT_EQ(s.pop().getValue(), 3);
+    char buf[16];
+    std::string written(buf, read(fds[0], buf, sizeof(buf)));
+    ASSERT_EQ(written, "ab\nef\n");
+
+    close(fds[0]);
+    close(fds[1]);
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, DroppedSyscallResults)
+{
+    // fd 9999 is not open, so the writes only fail
+    std::string code =  "proc w int ptr int -- int in 1 syscall3 end\n";
+                code += "proc k int ptr int -- int in 1 syscall3 end\n";
+                code += "proc fputs int ptr int in w drop end\n";
+                code += "proc wrap int ptr int -- int in w end\n";
+                code += "proc main in\n";
+                code += "    \"a\" 9999 fputs \"b\" 9999 wrap drop\n";
+                code += "    \"c\" 9999 k drop \"d\" 9999 k\n";
+                code += "end\n";
+
+    for (bool lazy : {false, true})
+    {
+        Lexer l(code);
+        Parser p(l.lex(), lazy);
+
+        Stack s;
+        Env e;
+        auto asts = p.parse();
+        interp(asts, s, e);
+
+        // w's result is dropped by fputs and, through wrap, by main
+        ASSERT_FALSE(((SyscallExpr *)e.getProc("w")->getBody().back())->resultUsed);
+        ASSERT_TRUE(((SyscallExpr *)e.getProc("k")->getBody().back())->resultUsed);
+        ASSERT_EQ(s.pop().getValue(), -EBADF);
+        p.cleanup(asts);
+    }
+}
+
+TEST (CPPorth, Trace)
+{
+    std::string code =  "const K 3 4 * end\n";
+                code += "proc main in K drop end\n";
+
+    options.trace = "cpporth_trace_test.json";
+    options.traceMinUs = 0;
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Stack s;
+    Env e;
+    auto asts = p.parse();
+    interp(asts, s, e);
+    ASSERT_TRUE(writeTrace(options.trace));
+    options.trace = "";
+    options.traceMinUs = 100;
+
+    auto json = openFile("cpporth_trace_test.json");
+    std::remove("cpporth_trace_test.json");
+    ASSERT_EQ(json.rfind("{\"traceEvents\": [", 0), 0);
+    ASSERT_NE(json.find("{\"name\": \"Lexer::lex\", \"cat\": \"load\", \"ph\": \"X\""), std::string::npos);
+    ASSERT_NE(json.find("\"name\": \"const K\""), std::string::npos);
+    ASSERT_NE(json.find("{\"name\": \"main\", \"cat\": \"proc\""), std::string::npos);
+
+    p.cleanup(asts);
+}
+
+TEST (CPPorth, AsmBackend)
+{
+    std::string code =  "memory buf 16 end\n";
+                code += "proc main in 7 buf 8 + !64 \"hi\\n\" 1 1 syscall3 drop end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Env e;
+    auto asts = p.parse();
+    load(asts, e);
+
+    std::ostringstream out;
+    emitAsm(e, out);
+    auto s = out.str();
+
+    ASSERT_NE(s.find("_start:"), std::string::npos);
+    // the folded address of buf 8 + is relocated into buf's .bss block
+    ASSERT_NE(s.find("[rip+mem_" + std::to_string(globalMemory().size()-1) + "+8]"), std::string::npos);
+    ASSERT_NE(s.find(": .zero 16    # buf"), std::string::npos);
+    ASSERT_NE(s.find("    .byte 104, 105, 10, 0\n"), std::string::npos);
+    ASSERT_NE(s.find("    syscall\n    push rax\n"), std::string::npos);
+
+    p.cleanup(asts);
+}
+
+// Compiles a program that indexes a global buffer with the superinstructions
+// on, runs it and checks what it prints.
+TEST (CPPorth, AsmBackendRuns)
+{
+    std::string code =  "memory buf 16 end\n";
+                code += "proc main in\n";
+                code += "    0 while dup 16 < do dup dup buf + !8 1 + end drop\n";
+                code += "    0 0 while dup 16 < do dup buf + @8 rot + swap 1 + end drop print\n";
+                code += "end\n";
+
+    Lexer l(code);
+    Parser p(l.lex());
+
+    Env e;
+    auto asts = p.parse();
+    load(asts, e);
+
+    char dir[] = "/tmp/cpporthasmXXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string base = std::string(dir) + "/buf";
+    ASSERT_TRUE(compileAsm(e, base));
+
+    FILE *run = popen(base.c_str(), "r");
+    ASSERT_NE(run, nullptr);
+    char buf[64];
+    std::string output(buf, fread(buf, 1, sizeof(buf), run));
+    ASSERT_EQ(pclose(run), 0);
+    ASSERT_EQ(output, "120\n");
+
+    std::system(("rm -rf " + std::string(dir)).c_str());
+    p.cleanup(asts);
+}
+
 int main(int argc, char** argv)
 {
     testing::InitGoogleTest();